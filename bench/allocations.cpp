@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Counts heap allocations so the memory used to build a tree can be reported.
+// Every replaceable form of new and delete is replaced, so that whatever form frees a block matches the one that allocated it.
+// They live in their own translation unit so the compiler never inlines a delete next to a new it can not see through.
+atomic<size_t> allocations(0), allocated(0);
+
+static void* allocate(size_t size) noexcept
+{
+	++allocations;
+	allocated += size;
+
+	return malloc(size ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+	if(void *p = allocate(size)) return p;
+
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	if(void *p = allocate(size)) return p;
+
+	throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+#if defined(__cpp_aligned_new)
+
+static void* allocate(size_t size, align_val_t alignment) noexcept
+{
+	++allocations;
+	allocated += size;
+
+	// aligned_alloc wants a size that is a multiple of the alignment.
+	const size_t a = static_cast<size_t>(alignment);
+
+	return aligned_alloc(a, (max<size_t>(size, 1) + a - 1) / a * a);
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+	if(void *p = allocate(size, alignment)) return p;
+
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+	if(void *p = allocate(size, alignment)) return p;
+
+	throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	return allocate(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	return allocate(size, alignment);
+}
+
+void operator delete(void *p, align_val_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, align_val_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t, align_val_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, align_val_t, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, align_val_t, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+#endif
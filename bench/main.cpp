@@ -0,0 +1,198 @@
+#include "expression_tree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace expression_tree;
+using namespace std;
+
+// Counted by the replacements of new and delete, in allocations.cpp.
+extern atomic<size_t> allocations, allocated;
+
+// The shapes of trees that are measured.
+enum class shape { balanced, left_deep, right_deep, random };
+
+const char* name(shape s)
+{
+	switch(s)
+	{
+		case shape::balanced: return "balanced";
+		case shape::left_deep: return "left_deep";
+		case shape::right_deep: return "right_deep";
+		case shape::random: default: return "random";
+	}
+}
+
+template<template<typename, typename> class C> const char* caching_name();
+template<> const char* caching_name<no_caching>() { return "no_caching"; }
+template<> const char* caching_name<cache_on_evaluation>() { return "cache_on_evaluation"; }
+template<> const char* caching_name<cache_on_assignment>() { return "cache_on_assignment"; }
+
+template<class E> const char* threading_name();
+template<> const char* threading_name<sequential>() { return "sequential"; }
+template<> const char* threading_name<parallel>() { return "parallel"; }
+
+// Leaf values of each measured type.
+template<typename T> struct values;
+
+template<> struct values<int>
+{
+	static const char* name() { return "int"; }
+	static int leaf(size_t i) { return static_cast<int>(i % 100); }
+};
+
+template<> struct values<double>
+{
+	static const char* name() { return "double"; }
+	static double leaf(size_t i) { return (i % 100) * 0.5; }
+};
+
+template<> struct values<string>
+{
+	static const char* name() { return "string"; }
+	static string leaf(size_t i) { return string(1, static_cast<char>('a' + i % 26)); }
+};
+
+// Settings of a run.
+struct settings
+{
+	size_t leaves = 1024;		// Number of leaves of each tree.
+	size_t variables = 8;		// One leaf in this many is a variable rather than a constant.
+	double duration = 0.2;		// Minimum number of seconds each tree is evaluated for.
+};
+
+// Builds a tree of the given shape with the given number of leaves.
+template<typename T, typename N>
+void build(N& n, shape s, size_t leaves, size_t& leaf, const T& variable, const settings& options, mt19937& random)
+{
+	if(leaves == 1)
+	{
+		if(leaf % options.variables == 0)
+		{
+			n = &variable;
+		}
+		else
+		{
+			n = values<T>::leaf(leaf);
+		}
+
+		++leaf;
+
+		return;
+	}
+
+	size_t left;
+	switch(s)
+	{
+		case shape::balanced: left = leaves / 2; break;
+		case shape::left_deep: left = leaves - 1; break;
+		case shape::right_deep: left = 1; break;
+		case shape::random: default: left = uniform_int_distribution<size_t>(1, leaves - 1)(random); break;
+	}
+
+	n = plus<T>();
+	build(n.left(), s, left, leaf, variable, options, random);
+	build(n.right(), s, leaves - left, leaf, variable, options, random);
+}
+
+// Measures one tree and prints one line of results.
+template<typename T, template<typename, typename> class C, class E>
+void measure(shape s, const settings& options)
+{
+	using clock = chrono::steady_clock;
+
+	T variable = values<T>::leaf(0);
+	mt19937 random(42);
+	size_t leaf = 0;
+
+	auto tree = make_unique<expression_tree::tree<T, C, E>>();
+
+	size_t allocations_before = allocations, allocated_before = allocated;
+	auto then = clock::now();
+
+	build(tree->root(), s, options.leaves, leaf, variable, options, random);
+
+	double build_seconds = chrono::duration<double>(clock::now() - then).count();
+	size_t build_allocations = allocations - allocations_before, build_bytes = allocated - allocated_before;
+
+	// Alternate the variable's value so caching can not elide the whole tree.
+	T alternatives[2] = {values<T>::leaf(1), values<T>::leaf(2)};
+	size_t evaluations = 0;
+	double fastest = numeric_limits<double>::max();
+
+	then = clock::now();
+	do
+	{
+		variable = alternatives[evaluations % 2];
+
+		auto start = clock::now();
+		tree->evaluate();
+		fastest = min(fastest, chrono::duration<double>(clock::now() - start).count());
+
+		++evaluations;
+	}
+	while(chrono::duration<double>(clock::now() - then).count() < options.duration);
+
+	double evaluate_seconds = chrono::duration<double>(clock::now() - then).count();
+
+	cout << values<T>::name() << ','
+		 << caching_name<C>() << ','
+		 << threading_name<E>() << ','
+		 << name(s) << ','
+		 << options.leaves << ','
+		 << build_seconds * 1e9 << ','
+		 << build_allocations << ','
+		 << build_bytes << ','
+		 << evaluations << ','
+		 << evaluate_seconds / evaluations * 1e9 << ','
+		 << fastest * 1e9 << ','
+		 << evaluations / evaluate_seconds << '\n';
+}
+
+// Mirrors all_policies in tests/correctness.cpp.
+template<typename T>
+void all_policies(shape s, const settings& options)
+{
+	measure<T, no_caching, sequential>(s, options);
+	measure<T, no_caching, parallel>(s, options);
+
+	measure<T, cache_on_evaluation, sequential>(s, options);
+	measure<T, cache_on_evaluation, parallel>(s, options);
+
+	measure<T, cache_on_assignment, sequential>(s, options);
+	measure<T, cache_on_assignment, parallel>(s, options);
+}
+
+// Usage: bench [leaves [variables [duration]]]
+//
+// Prints one CSV line per value type, policy combination and tree shape.
+int main(int argc, char *argv[])
+{
+	settings options;
+
+	cout << fixed;
+	cout.precision(1);
+
+	if(argc > 1) options.leaves = max<size_t>(1, strtoul(argv[1], nullptr, 10));
+	if(argc > 2) options.variables = max<size_t>(1, strtoul(argv[2], nullptr, 10));
+	if(argc > 3) options.duration = strtod(argv[3], nullptr);
+
+	cout << "type,caching,threading,shape,leaves,build_ns,build_allocations,build_bytes,evaluations,evaluate_mean_ns,evaluate_min_ns,evaluations_per_s\n";
+
+	for(auto s : {shape::balanced, shape::left_deep, shape::right_deep, shape::random})
+	{
+		all_policies<int>(s, options);
+		all_policies<double>(s, options);
+		all_policies<string>(s, options);
+	}
+
+	return 0;
+}
@@ -29,9 +29,23 @@
 #if !defined(EXPRESSION_TREE_H)
      #define EXPRESSION_TREE_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
+#include <limits>
 #include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace expression_tree
 {
@@ -48,21 +62,644 @@ namespace detail
 template<typename T>
 using operation = std::function<T (const T&, const T&)>;
 
+//!\brief Unary operations are what unary branches perform on their only child.
+//!
+//! Unary operations must take a T as argument and return a T.
+template<typename T>
+using unary_operation = std::function<T (const T&)>;
+
+//!\brief Grants the library's algorithms access to a node's internals.
+struct access
+{
+	//!\brief A node's implementation.
+	template<typename N>
+	static auto& impl(N& n)
+	{
+		return n.impl;
+	}
+
+	//!\brief A node's parent.
+	template<typename N>
+	static auto& parent(N& n)
+	{
+		return n.parent;
+	}
+
+	//!\brief Makes a node the parent of its implementation's children.
+	template<typename N>
+	static void adopt(N& n)
+	{
+		n.adopt();
+	}
+
+	//!\brief Notifies a node's parent, or the node itself if it is a root, that the node was modified.
+	template<typename N>
+	static void notify(N& n)
+	{
+		n.notify();
+	}
+};
+
+}
+
+//!\brief Identifies an operation within an operation_registry.
+using operation_id = std::uint32_t;
+
+//!\brief Identifier carried by branches whose operation was not obtained from an operation_registry.
+constexpr operation_id unregistered_operation = std::numeric_limits<operation_id>::max();
+
+//!\brief Sides of an operation on which an element has a property.
+enum class side : std::uint8_t
+{
+	none = 0,	//!< The element does not have the property.
+	left = 1,	//!< The element has the property as a left operand.
+	right = 2,	//!< The element has the property as a right operand.
+	both = 3	//!< The element has the property as either operand.
+};
+
+//!\brief Whether \c s includes \c t.
+inline bool includes(side s, side t)
+{
+	return (static_cast<std::uint8_t>(s) & static_cast<std::uint8_t>(t)) == static_cast<std::uint8_t>(t);
+}
+
+//!\brief Arithmetic operations that passes recognize.
+enum class arithmetic : std::uint8_t
+{
+	none,			//!< Not a recognized arithmetic operation.
+	addition,		//!< Addition of numbers.
+	subtraction,	//!< Subtraction of numbers.
+	multiplication,	//!< Multiplication of numbers.
+	division		//!< Division of numbers.
+};
+
+//!\brief Algebraic properties of an operation.
+//!
+//! Nothing is assumed of an operation by default. Properties are only ever used to rewrite trees into equivalent ones.
+template<typename T>
+struct operation_traits
+{
+	bool associative = false;			//!< Whether <tt>f(f(a, b), c) == f(a, f(b, c))</tt>.
+	bool commutative = false;			//!< Whether <tt>f(a, b) == f(b, a)</tt>.
+	bool pure = false;					//!< Whether the operation's value only depends on its operands and it has no side effects.
+	side identity_side = side::none;	//!< Where \c identity leaves the other operand unchanged, e.g. <tt>f(a, identity) == a</tt> on the right.
+	T identity = T();					//!< The identity element, if \c identity_side is not \c side::none.
+	side absorbing_side = side::none;	//!< Where \c absorbing makes the result, e.g. <tt>f(absorbing, a) == absorbing</tt> on the left.
+	T absorbing = T();					//!< The absorbing element, if \c absorbing_side is not \c side::none.
+	double cost = 1.;					//!< Relative cost of applying the operation, an addition costing 1.
+	arithmetic kind = arithmetic::none;	//!< Which arithmetic operation this is, if any.
+};
+
+namespace detail
+{
+
+//!\brief The traits known of operations of type \c F on values of type \c T.
+//!
+//! Nothing is known of arbitrary callables.
+template<typename T, typename F>
+struct known_traits
+{
+	//!\brief The traits.
+	static operation_traits<T> get()
+	{
+		return operation_traits<T>();
+	}
+};
+
+//!\brief Whether the usual algebraic properties of arithmetic hold for \c T.
+//!
+//! They do not for floating point values, whose operations round.
+template<typename T>
+struct exact_arithmetic : std::integral_constant<bool, std::is_integral<T>::value> {};
+
+//!\brief Addition.
+//!
+//! Addition of strings is concatenation, which is associative but not commutative.
+template<typename T>
+struct known_traits<T, std::plus<T>>
+{
+	//!\brief The traits.
+	static operation_traits<T> get()
+	{
+		operation_traits<T> t;
+
+		t.pure = std::is_arithmetic<T>::value || std::is_same<T, std::string>::value;
+		t.associative = exact_arithmetic<T>::value || std::is_same<T, std::string>::value;
+		t.commutative = std::is_arithmetic<T>::value;
+		t.identity_side = t.pure ? side::both : side::none;
+		t.kind = std::is_arithmetic<T>::value ? arithmetic::addition : arithmetic::none;
+
+		return t;
+	}
+};
+
+//!\brief Subtraction.
+template<typename T>
+struct known_traits<T, std::minus<T>>
+{
+	//!\brief The traits.
+	static operation_traits<T> get()
+	{
+		operation_traits<T> t;
+
+		t.pure = std::is_arithmetic<T>::value;
+		t.identity_side = t.pure ? side::right : side::none;
+		t.kind = t.pure ? arithmetic::subtraction : arithmetic::none;
+
+		return t;
+	}
+};
+
+//!\brief Multiplication.
+//!
+//! Zero only absorbs exact values: a floating point infinity times zero is not a number.
+template<typename T>
+struct known_traits<T, std::multiplies<T>>
+{
+	//!\brief The traits.
+	static operation_traits<T> get()
+	{
+		operation_traits<T> t;
+
+		t.pure = std::is_arithmetic<T>::value;
+		t.associative = exact_arithmetic<T>::value;
+		t.commutative = t.pure;
+		t.identity_side = t.pure ? side::both : side::none;
+		t.identity = T(1);
+		t.absorbing_side = exact_arithmetic<T>::value ? side::both : side::none;
+		t.cost = 3.;
+		t.kind = t.pure ? arithmetic::multiplication : arithmetic::none;
+
+		return t;
+	}
+};
+
+//!\brief Division.
+template<typename T>
+struct known_traits<T, std::divides<T>>
+{
+	//!\brief The traits.
+	static operation_traits<T> get()
+	{
+		operation_traits<T> t;
+
+		t.pure = std::is_arithmetic<T>::value;
+		t.identity_side = t.pure ? side::right : side::none;
+		t.identity = T(1);
+		t.cost = 20.;
+		t.kind = t.pure ? arithmetic::division : arithmetic::none;
+
+		return t;
+	}
+};
+
+}
+
+//!\brief An operation paired with the identifier and the name it was registered with.
+template<typename T>
+struct registered_operation
+{
+	operation_id id;			//!< This operation's identifier in its registry.
+	std::string name;			//!< This operation's name.
+	detail::operation<T> f;		//!< The operation itself.
+	operation_traits<T> traits;	//!< This operation's algebraic properties.
+};
+
+//!\brief Stores operations so they can be referred to by identifier or by name.
+//!
+//! Assigning a registered_operation to a node makes it a branch that remembers the operation's identifier.
+//! This is what allows trees to be saved and loaded.
+template<typename T>
+class operation_registry
+{
+	std::deque<registered_operation<T>> operations;			//!< Registered operations, indexed by their identifier.
+	std::unordered_map<std::string, operation_id> names;	//!< Maps names to identifiers.
+
+public:
+	//!\brief Registers an operation.
+	//!
+	//! The traits of \c std::plus, \c std::minus, \c std::multiplies and \c std::divides are known.
+	//! Nothing is assumed of other operations.
+	//!
+	//!\param name The name of the operation. It must not already be registered.
+	//!\param f The operation.
+	//!\return The registered operation. It remains valid for the lifetime of this registry.
+	template<typename F>
+	const registered_operation<T>& add(const std::string& name, const F& f)
+	{
+		return add(name, f, detail::known_traits<T, F>::get());
+	}
+
+	//!\brief Registers an operation with its algebraic properties.
+	//!
+	//!\param name The name of the operation. It must not already be registered.
+	//!\param f The operation.
+	//!\param traits The operation's algebraic properties.
+	//!\return The registered operation. It remains valid for the lifetime of this registry.
+	const registered_operation<T>& add(const std::string& name, const detail::operation<T>& f, const operation_traits<T>& traits)
+	{
+		if(names.count(name))
+		{
+			throw std::invalid_argument("operation \"" + name + "\" is already registered");
+		}
+
+		operation_id id = static_cast<operation_id>(operations.size());
+
+		operations.push_back({id, name, f, traits});
+		names.emplace(name, id);
+
+		return operations.back();
+	}
+
+	//!\brief The operation registered with identifier \c id.
+	//!
+	//! Note that if no such operation exists, behavior is undefined.
+	const registered_operation<T>& operator[](operation_id id) const
+	{
+		return operations[id];
+	}
+
+	//!\brief Whether \c o is an operation registered in this registry.
+	//!
+	//! Identifiers are only unique within a registry, so this tells whether a branch's operation really comes from this one.
+	bool contains(const registered_operation<T> *o) const
+	{
+		return o && o->id < operations.size() && &operations[o->id] == o;
+	}
+
+	//!\brief The operation registered with name \c name or \c nullptr if there is none.
+	const registered_operation<T>* find(const std::string& name) const
+	{
+		auto i = names.find(name);
+
+		return i == names.end() ? nullptr : &operations[i->second];
+	}
+
+	//!\brief The number of registered operations.
+	std::size_t size() const
+	{
+		return operations.size();
+	}
+};
+
+//!\brief Reductions are what n-ary branches perform on their children.
+//!
+//! Reductions take the values of all children, as a contiguous array, and their number and return a T.
+template<typename T>
+using reduction = std::function<T (const T*, std::size_t)>;
+
+//!\brief A reduction paired with the number of children it applies to.
+//!
+//! Assigning an n-ary operation to a node makes it a branch with that many children.
+template<typename T>
+struct nary_operation
+{
+	reduction<T> f;			//!< The reduction.
+	std::size_t arity;		//!< The number of children.
+};
+
+//!\brief An n-ary operation that applies \c f to \c arity children.
+template<typename T>
+nary_operation<T> nary(const reduction<T>& f, std::size_t arity)
+{
+	return {f, arity};
+}
+
+//!\brief An n-ary operation that adds the values of \c arity children.
+template<typename T>
+nary_operation<T> sum(std::size_t arity)
+{
+	return {[](const T *v, std::size_t n){ return std::accumulate(v + 1, v + n, v[0], std::plus<T>()); }, arity};
+}
+
+//!\brief An n-ary operation that multiplies the values of \c arity children.
+template<typename T>
+nary_operation<T> product(std::size_t arity)
+{
+	return {[](const T *v, std::size_t n){ return std::accumulate(v + 1, v + n, v[0], std::multiplies<T>()); }, arity};
+}
+
+//!\brief An n-ary operation that yields the least of the values of \c arity children.
+template<typename T>
+nary_operation<T> minimum(std::size_t arity)
+{
+	return {[](const T *v, std::size_t n){ return *std::min_element(v, v + n); }, arity};
+}
+
+//!\brief An n-ary operation that yields the greatest of the values of \c arity children.
+template<typename T>
+nary_operation<T> maximum(std::size_t arity)
+{
+	return {[](const T *v, std::size_t n){ return *std::max_element(v, v + n); }, arity};
+}
+
+//!\brief Gives lazy operations the values of their branch's children, evaluating each only when it is asked for.
+template<typename T>
+class lazy_children
+{
+public:
+	virtual ~lazy_children() {}
+
+	//!\brief The number of children.
+	virtual std::size_t size() const = 0;
+
+	//!\brief Evaluates child \c i.
+	virtual T operator[](std::size_t i) const = 0;
+};
+
+//!\brief Lazy reductions are what lazy branches perform on their children.
+//!
+//! Lazy reductions take their children, which they evaluate as needed, and return a T.
+template<typename T>
+using lazy_reduction = std::function<T (const lazy_children<T>&)>;
+
+//!\brief A lazy reduction paired with the number of children it applies to.
+//!
+//! Assigning a lazy operation to a node makes it a branch with that many children, which are only evaluated when the reduction asks for them.
+//!
+//! If \c decides is set, children are interchangeable and a child whose value satisfies it settles the result.
+//! The branch can then adapt the order in which it evaluates its children: every \c reorder_period evaluations,
+//! it sorts them by increasing ratio of their time spent evaluating to their number of settling values,
+//! so that cheap children that often settle the result are evaluated first.
+template<typename T>
+struct lazy_operation
+{
+	lazy_reduction<T> f;							//!< The reduction.
+	std::size_t arity;								//!< The number of children.
+	std::function<bool (const T&)> decides = nullptr;	//!< Whether a child's value settles the result, if children are interchangeable.
+	std::size_t reorder_period = 0;					//!< Number of evaluations between reorderings of the children, zero to never reorder them.
+};
+
+//!\brief Whether a value counts as true for lazy operations: it does unless it equals a default-constructed \c T.
+template<typename T>
+bool truthy(const T& t)
+{
+	return !(t == T());
+}
+
+//!\brief A lazy operation that evaluates its first child and then only its second child if that is truthy, or only its third child otherwise.
+template<typename T>
+lazy_operation<T> if_then_else()
+{
+	return {[](const lazy_children<T>& c){ return truthy(c[0]) ? c[1] : c[2]; }, 3};
+}
+
+//!\brief A lazy operation that evaluates its \c arity children in order until one is not truthy.
+//!
+//! Its value is that of the first child that is not truthy or, if all are, that of the last one.
+//!
+//!\param arity The number of children.
+//!\param reorder_period If not zero, the number of evaluations after which children are reordered so that cheap children that are often not truthy come first.
+//! Only \c bool children are reordered, since any of their values that is not truthy is \c false. For other types, it is ignored so the value of the branch does not change.
+template<typename T>
+lazy_operation<T> short_circuit_and(std::size_t arity = 2, std::size_t reorder_period = 0)
+{
+	return {[](const lazy_children<T>& c)
+			{
+				T t = c[0];
+				for(std::size_t i = 1; i != c.size() && truthy(t); ++i)
+				{
+					t = c[i];
+				}
+
+				return t;
+			}, arity, [](const T& t){ return !truthy(t); }, std::is_same<T, bool>::value ? reorder_period : 0};
+}
+
+//!\brief A lazy operation that evaluates its \c arity children in order until one is truthy.
+//!
+//! Its value is that of the first child that is truthy or, if none is, that of the last one.
+//!
+//!\param arity The number of children.
+//!\param reorder_period If not zero, the number of evaluations after which children are reordered so that cheap children that are often truthy come first.
+//! Only \c bool children are reordered, since any of their values that is truthy is \c true. For other types, it is ignored so the value of the branch does not change.
+template<typename T>
+lazy_operation<T> short_circuit_or(std::size_t arity = 2, std::size_t reorder_period = 0)
+{
+	return {[](const lazy_children<T>& c)
+			{
+				T t = c[0];
+				for(std::size_t i = 1; i != c.size() && !truthy(t); ++i)
+				{
+					t = c[i];
+				}
+
+				return t;
+			}, arity, [](const T& t){ return truthy(t); }, std::is_same<T, bool>::value ? reorder_period : 0};
+}
+
+//!\brief An operation whose type is known statically.
+//!
+//! Assigning a typed operation to a node makes it a binary branch that stores the functor itself rather than a detail::operation.
+//! Applying it is then a direct call that the compiler can inline, and building the branch never allocates for the functor.
+template<typename T, typename O>
+struct typed_operation
+{
+	O f;	//!< The functor, taking two \c T and returning a \c T.
+};
+
+//!\brief Makes a typed operation out of a functor, e.g. <tt>typed<int>(std::plus<int>())</tt>.
+template<typename T, typename O>
+typed_operation<T, O> typed(const O& f)
+{
+	return {f};
+}
+
+//!\brief Tells whether a stop was requested from the stop_source it was obtained from.
+class stop_token
+{
+	std::shared_ptr<std::atomic<bool>> stopped;	//!< Shared with the stop_source.
+
+	friend class stop_source;
+
+	//!\brief Constructor.
+	stop_token(const std::shared_ptr<std::atomic<bool>>& stopped) : stopped(stopped) {}
+
+public:
+	//!\brief Default constructor. A default-constructed token is never stopped.
+	stop_token() {}
+
+	//!\brief Whether a stop was requested.
+	bool stop_requested() const
+	{
+		return stopped && stopped->load(std::memory_order_relaxed);
+	}
+};
+
+//!\brief Requests the stop of evaluations that were given one of its stop_tokens.
+class stop_source
+{
+	std::shared_ptr<std::atomic<bool>> stopped;	//!< Shared with the stop_tokens.
+
+public:
+	//!\brief Default constructor.
+	stop_source() : stopped(std::make_shared<std::atomic<bool>>(false)) {}
+
+	//!\brief A token that tells whether a stop was requested from this source.
+	stop_token token() const
+	{
+		return stop_token(stopped);
+	}
+
+	//!\brief Requests a stop. It is safe to call from any thread.
+	void request_stop()
+	{
+		stopped->store(true, std::memory_order_relaxed);
+	}
+
+	//!\brief Whether a stop was requested.
+	bool stop_requested() const
+	{
+		return stopped->load(std::memory_order_relaxed);
+	}
+};
+
+//!\brief How an interruptible evaluation ended.
+enum class evaluation_status
+{
+	completed,	//!< The value was computed.
+	cancelled,	//!< A stop was requested before the value was computed.
+	timed_out	//!< The deadline passed before the value was computed.
+};
+
+namespace detail
+{
+
+//!\brief Thrown out of an interrupted evaluation. It never escapes the library.
+struct interrupted {};
+
+//!\brief What an interruptible evaluation checks between branch evaluations.
+//!
+//! A context is installed on the thread that starts the evaluation and on every thread that evaluates part of it.
+//! When one thread is interrupted, all others stop at their next check.
+class evaluation_context
+{
+	stop_token token;									//!< Tells whether a stop was requested.
+	std::chrono::steady_clock::time_point deadline;		//!< When to give up.
+	std::atomic<evaluation_status> status;				//!< \c completed until the evaluation is interrupted.
+	std::atomic<unsigned> checks;						//!< Number of checks made since the clock was last read.
+	std::atomic<unsigned> period;						//!< Number of checks between two readings of the clock.
+	std::atomic<unsigned> readings;						//!< Number of times the clock was read, up to 16.
+	std::atomic<std::chrono::steady_clock::rep> last;	//!< When the clock was last read.
+
+public:
+	//!\brief Makes a context the current one of this thread for the lifetime of this object.
+	class scope
+	{
+		evaluation_context *previous;	//!< Restored upon destruction.
+
+	public:
+		//!\brief Constructor.
+		scope(evaluation_context *c) : previous(current())
+		{
+			current() = c;
+		}
+
+		~scope()
+		{
+			current() = previous;
+		}
+	};
+
+	//!\brief Constructor.
+	evaluation_context(const stop_token& token, std::chrono::steady_clock::time_point deadline) : token(token), deadline(deadline), status(evaluation_status::completed), checks(0), period(1), readings(0), last(std::chrono::steady_clock::now().time_since_epoch().count()) {}
+
+	//!\brief This thread's current context, if any.
+	static evaluation_context*& current()
+	{
+		static thread_local evaluation_context *c = nullptr;
+
+		return c;
+	}
+
+	//!\brief Why the evaluation was interrupted, if it was.
+	evaluation_status why() const
+	{
+		return status;
+	}
+
+	//!\brief Throws interrupted if a stop was requested or if the deadline passed.
+	//!
+	//! The clock is read at each of the first 16 checks, so that evaluations with few branches never overrun their deadline unnoticed.
+	//! It is then read at every check while checks are more than a microsecond apart, as when branches' operations are slow,
+	//! and up to every 16th check as they come faster.
+	void check()
+	{
+		if(status != evaluation_status::completed)
+		{
+			throw interrupted();
+		}
+
+		if(token.stop_requested())
+		{
+			status = evaluation_status::cancelled;
+			throw interrupted();
+		}
+
+		if(deadline == std::chrono::steady_clock::time_point::max() || checks.fetch_add(1, std::memory_order_relaxed) + 1 < period.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if(now >= deadline)
+		{
+			status = evaluation_status::timed_out;
+			throw interrupted();
+		}
+
+		// Concurrent checks may race on these, which only makes the clock be read a little more or less often.
+		const std::chrono::steady_clock::duration elapsed(now.time_since_epoch().count() - last.exchange(now.time_since_epoch().count(), std::memory_order_relaxed));
+		const unsigned p = period.load(std::memory_order_relaxed);
+
+		checks.store(0, std::memory_order_relaxed);
+		if(readings.load(std::memory_order_relaxed) < 16)
+		{
+			readings.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			period.store(elapsed > std::chrono::microseconds(1) * p ? 1 : std::min(p * 2, 16u), std::memory_order_relaxed);
+		}
+	}
+};
+
+//!\brief Interrupts the evaluation in progress on this thread, if it is interruptible and ought to be.
+inline void interruption_point()
+{
+	if(auto c = evaluation_context::current())
+	{
+		c->check();
+	}
+}
+
 }
 
 //!\brief Performs parallel evaluation of a branch's children before applying its operation.
 struct parallel
 {
 	//!\brief Spawns a parallel evaluation task for the left child and evaluates the right child on the current thread.
-	template<typename T, template<typename, typename> class C, class E>
-	static T evaluate(const detail::operation<T>& o, const node<T, C, E>& l, const node<T, C, E>& r)
+	//!
+	//! The task shares the current thread's evaluation context, so it stops as soon as the evaluation is interrupted.
+	template<typename O, typename T, template<typename, typename> class C, class E>
+	static T evaluate(const O& o, const node<T, C, E>& l, const node<T, C, E>& r)
 	{
-		std::future<T> f = std::async(&node<T, C, E>::evaluate, &l);
+		detail::interruption_point();
+
+		auto c = detail::evaluation_context::current();
+		std::future<T> f = std::async([c, &l]
+		{
+			detail::evaluation_context::scope s(c);
+			return l.evaluate();
+		});
 
 		// Let's not rely on any assumption of parameter evaluation order...
 		T t = r.evaluate();
+		T u = f.get();
+
+		detail::interruption_point();
 
-		return o(f.get(), t);
+		return o(u, t);
 	}
 };
 
@@ -70,16 +707,220 @@ struct parallel
 struct sequential
 {
 	//!\brief Evaluates the right child and then the left child on the current thread.
-	template<typename T, template<typename, typename> class C, class E>
-	static T evaluate(const detail::operation<T>& o, const node<T, C, E>& l, const node<T, C, E>& r)
+	template<typename O, typename T, template<typename, typename> class C, class E>
+	static T evaluate(const O& o, const node<T, C, E>& l, const node<T, C, E>& r)
 	{
-		return o(l.evaluate(), r.evaluate());
+		T t = r.evaluate();
+		T u = l.evaluate();
+
+		detail::interruption_point();
+
+		return o(u, t);
+	}
+};
+
+//!\brief Counts of the events that affect the effectiveness of caching branches.
+struct cache_counters
+{
+	std::uint64_t hits = 0;					//!< Evaluations that returned a cached value.
+	std::uint64_t misses = 0;				//!< Evaluations that applied the branch's operation.
+	std::uint64_t invalidations = 0;		//!< Cached values discarded because a child was modified.
+	std::uint64_t eager_evaluations = 0;	//!< Operations applied upon the modification of a child rather than upon evaluation.
+
+	//!\brief Adds another set of counts to this one.
+	cache_counters& operator+=(const cache_counters& other)
+	{
+		hits += other.hits;
+		misses += other.misses;
+		invalidations += other.invalidations;
+		eager_evaluations += other.eager_evaluations;
+
+		return *this;
+	}
+};
+
+//!\brief Threading policy that has caching branches keep cache_counters.
+//!
+//! Evaluation itself is delegated to \c ThreadingPolicy.
+//! Branches of trees instantiated with other threading policies keep no counters and bear no cost.
+template<class ThreadingPolicy = sequential>
+struct counted
+{
+	static const bool counts_cache = true;	//!< Tells caching branches to count.
+
+	//!\brief Evaluates a branch's children and applies its operation with \c ThreadingPolicy.
+	template<typename O, typename T, template<typename, typename> class C, class E>
+	static T evaluate(const O& o, const node<T, C, E>& l, const node<T, C, E>& r)
+	{
+		return ThreadingPolicy::evaluate(o, l, r);
+	}
+};
+
+//!\brief Bytes used by the nodes of a tree, broken down by kind of node.
+struct memory_footprint
+{
+	std::size_t constants = 0;	//!< Leaves that store a value.
+	std::size_t pointers = 0;	//!< Leaves that store a pointer.
+	std::size_t callables = 0;	//!< Leaves that store a callable.
+	std::size_t branches = 0;	//!< Branches, their children's node objects and their cached value included but their operation excluded.
+	std::size_t operations = 0;	//!< The operations of branches. Captures a callable stores on the heap are not accounted for.
+	std::size_t values = 0;		//!< Heap memory owned by the values of leaves and branches, e.g. the characters of long strings.
+
+	//!\brief The sum of all bytes.
+	std::size_t total() const
+	{
+		return constants + pointers + callables + branches + operations + values;
+	}
+};
+
+//!\brief Counts the allocations and deallocations of node implementations while it is started.
+//!
+//! At most one counter is started at a time. Counting is thread-safe.
+class allocation_counter
+{
+	//!\brief The currently started counter.
+	static std::atomic<allocation_counter*>& active()
+	{
+		static std::atomic<allocation_counter*> a(nullptr);
+
+		return a;
+	}
+
+public:
+	std::atomic<std::uint64_t> allocations{0};		//!< Number of node implementations allocated.
+	std::atomic<std::uint64_t> deallocations{0};	//!< Number of node implementations deallocated.
+	std::atomic<std::uint64_t> allocated{0};		//!< Bytes allocated.
+	std::atomic<std::uint64_t> deallocated{0};		//!< Bytes deallocated.
+
+	//!\brief Stops this counter if it is started.
+	~allocation_counter()
+	{
+		stop();
+	}
+
+	//!\brief The currently started counter, if any.
+	static allocation_counter* current()
+	{
+		return active().load(std::memory_order_relaxed);
+	}
+
+	//!\brief Makes this counter the one allocations are counted in.
+	void start()
+	{
+		active().store(this);
+	}
+
+	//!\brief Stops counting, if this counter was started.
+	void stop()
+	{
+		allocation_counter *self = this;
+		active().compare_exchange_strong(self, nullptr);
 	}
 };
 
 namespace detail
 {
 
+//!\brief Heap memory owned by a value.
+//!
+//! This default implementation assumes values own no heap memory.
+template<typename T>
+struct heap_size
+{
+	//!\brief Heap memory owned by \c t.
+	static std::size_t of(const T&)
+	{
+		return 0;
+	}
+};
+
+//!\brief Heap memory owned by a string, none if its characters are stored in the string object itself.
+template<typename C, typename Traits, typename Allocator>
+struct heap_size<std::basic_string<C, Traits, Allocator>>
+{
+	//!\brief Heap memory owned by \c s.
+	static std::size_t of(const std::basic_string<C, Traits, Allocator>& s)
+	{
+		auto data = reinterpret_cast<const char*>(s.data()), object = reinterpret_cast<const char*>(&s);
+
+		return data >= object && data < object + sizeof(s) ? 0 : (s.capacity() + 1) * sizeof(C);
+	}
+};
+
+//!\brief Whether a ThreadingPolicy wants caching branches to keep cache_counters.
+template<class ThreadingPolicy, typename = void>
+struct counts_cache : std::false_type {};
+
+//!\brief Whether a ThreadingPolicy wants caching branches to keep cache_counters.
+template<class ThreadingPolicy>
+struct counts_cache<ThreadingPolicy, typename std::enable_if<ThreadingPolicy::counts_cache>::type> : std::true_type {};
+
+//!\brief Base class of caching branches that keeps their cache_counters.
+//!
+//! This default implementation counts nothing and takes no space.
+template<class ThreadingPolicy, bool = counts_cache<ThreadingPolicy>::value>
+class cache_counting
+{
+protected:
+	void hit() const {}				//!< Does nothing.
+	void miss() const {}			//!< Does nothing.
+	void invalidated() const {}		//!< Does nothing.
+	void eagerly_evaluated() const {}	//!< Does nothing.
+
+	//!\brief No counts.
+	cache_counters counters() const
+	{
+		return cache_counters();
+	}
+};
+
+//!\brief Base class of caching branches that keeps their cache_counters.
+//!
+//! Counts are not copied: a copied branch starts counting anew.
+template<class ThreadingPolicy>
+class cache_counting<ThreadingPolicy, true>
+{
+	mutable cache_counters c;	//!< The counts.
+
+protected:
+	//!\brief Default constructor.
+	cache_counting() {}
+
+	//!\brief Copy constructor.
+	cache_counting(const cache_counting&) {}
+
+	void hit() const { ++c.hits; }								//!< Counts a cache hit.
+	void miss() const { ++c.misses; }							//!< Counts a cache miss.
+	void invalidated() const { ++c.invalidations; }				//!< Counts the invalidation of a cached value.
+	void eagerly_evaluated() const { ++c.eager_evaluations; }	//!< Counts an eager evaluation.
+
+	//!\brief The counts.
+	cache_counters counters() const
+	{
+		return c;
+	}
+};
+
+//!\brief Whether a ThreadingPolicy wants to be told about cache hits.
+template<class ThreadingPolicy, typename N, typename = void>
+struct observes_cache_hits : std::false_type {};
+
+//!\brief Whether a ThreadingPolicy wants to be told about cache hits.
+template<class ThreadingPolicy, typename N>
+struct observes_cache_hits<ThreadingPolicy, N, decltype(ThreadingPolicy::cache_hit(std::declval<const N&>()))> : std::true_type {};
+
+//!\brief Tells a ThreadingPolicy that the branch whose left child is \c l returned its cached value.
+template<class ThreadingPolicy, typename N>
+typename std::enable_if<observes_cache_hits<ThreadingPolicy, N>::value>::type cache_hit(const N& l)
+{
+	ThreadingPolicy::cache_hit(l);
+}
+
+//!\brief Does nothing for ThreadingPolicies that have no static \c cache_hit member function.
+template<class ThreadingPolicy, typename N>
+typename std::enable_if<!observes_cache_hits<ThreadingPolicy, N>::value>::type cache_hit(const N&)
+{}
+
 //!\brief Base class for the node class internal implementation.
 template<typename T>
 class node_impl
@@ -103,6 +944,33 @@ public:
 	//! A leaf will evaluate to itself.
 	//! A branch will evaluate to its operation applied to its left and right children.
 	virtual T evaluate() const = 0;
+
+	//!\brief Adds the memory used by this node and its children to \c m.
+	virtual void measure(memory_footprint& m) const = 0;
+
+	//!\brief Allocates a node implementation, counting it if an allocation_counter is started.
+	static void* operator new(std::size_t size)
+	{
+		if(auto c = allocation_counter::current())
+		{
+			++c->allocations;
+			c->allocated += size;
+		}
+
+		return ::operator new(size);
+	}
+
+	//!\brief Deallocates a node implementation, counting it if an allocation_counter is started.
+	static void operator delete(void *p, std::size_t size)
+	{
+		if(auto c = allocation_counter::current())
+		{
+			++c->deallocations;
+			c->deallocated += size;
+		}
+
+		::operator delete(p);
+	}
 };
 
 //!\brief Leaf class.
@@ -141,6 +1009,19 @@ public:
 	{
 		return value;
 	}
+
+	//! A leaf's value may own heap memory.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.constants += sizeof(*this);
+		m.values += heap_size<T>::of(value);
+	}
+
+	//!\brief This node's value.
+	const T& data() const
+	{
+		return value;
+	}
 };
 
 //!\brief Leaf class specialized to T*.
@@ -179,6 +1060,18 @@ public:
 	{
 		return *p;
 	}
+
+	//! The data pointed to is not accounted for.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.pointers += sizeof(*this);
+	}
+
+	//!\brief This node's pointer to data.
+	const T* pointer() const
+	{
+		return p;
+	}
 };
 
 //!\brief Leaf class specialized to a callable.
@@ -203,100 +1096,572 @@ public:
 	//!\brief Clones this object.
 	virtual std::unique_ptr<node_impl<T>> clone() const override
 	{
-		return std::make_unique<leaf<T (*)()>>(*this);
+		return std::make_unique<leaf<T (*)()>>(*this);
+	}
+	
+	//! Because this class stores a pointer to its data, it is not constant.
+	virtual bool constant() const override
+	{
+		return false;
+	}
+	
+	//! Dereference our pointer.
+	virtual T evaluate() const override
+	{
+		return f();
+	}
+
+	//! Captures the callable stores on the heap are not accounted for.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.callables += sizeof(*this);
+	}
+
+	//!\brief The callable.
+	const std::function<T ()>& callable() const
+	{
+		return f;
+	}
+};
+
+//!\brief Base class of all kinds of branches.
+//!
+//! A branch applies an operation to the values of its children.
+//! This class keeps track of the constness of the branch and gives access to its children.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class branch_base : public node_impl<T>
+{
+protected:
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	//!\brief This branch's \c i th child.
+	virtual node_t& at(std::size_t i) = 0;
+
+public:
+    //!\brief A version of the poor man's tri-state bool.
+    mutable enum constness_e : char { true_, false_, indeterminate } constant_; //!< Caches wether this branch is constant.
+
+	//!\brief Default constructor.
+	branch_base() : constant_(indeterminate) {}
+
+	//!\brief Copy constructor.
+	branch_base(const branch_base& other) : constant_(other.constant_) {}
+
+	virtual ~branch_base() {}
+
+	//!\brief The number of children of this branch.
+	virtual std::size_t arity() const = 0;
+
+	//!\brief This branch's \c i th child.
+	node_t& child(std::size_t i)
+	{
+		return at(i);
+	}
+
+	//!\brief This branch's \c i th child.
+	const node_t& child(std::size_t i) const
+	{
+		return const_cast<branch_base*>(this)->at(i);
+	}
+
+	//! The constness of a branch is determined by the constness of its children.
+	virtual bool constant() const override
+	{
+        if(constant_ == indeterminate)
+        {
+			constant_ = true_;
+			for(std::size_t i = 0; i != arity() && constant_ == true_; ++i)
+			{
+				if(!child(i).constant())
+				{
+					constant_ = false_;
+				}
+			}
+        }
+
+		return constant_ == true_;
+	}
+
+	//! This function is called when anyone of this branch's children is modified.
+	//! This default implementation forgets the constness of the branch.
+	virtual void modified()
+	{
+        constant_ = indeterminate;
+	}
+
+	//!\brief This branch's cache counters.
+	//!
+	//! This default implementation caches nothing and thus counts nothing.
+	virtual cache_counters cache_statistics() const
+	{
+		return cache_counters();
+	}
+};
+
+//!\brief Branch class.
+//!
+//! This class stores an operation and two children nodes.
+//! This default implementation does \a no caching optimization.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class default_branch : public branch_base<T, CachingPolicy, ThreadingPolicy>
+{
+protected:
+	//! The left child is child 0 and the right child is child 1.
+	virtual node<T, CachingPolicy, ThreadingPolicy>& at(std::size_t i) override
+	{
+		return i ? r : l;
+	}
+
+public:
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+	using default_branch_t = default_branch<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+	
+	node_t l;	//!< This branch's left child.
+	node_t r;	//!< This branch's right child.
+	operation<T> f;	//!< Operation to be applied to this node's children.
+	operation_id id;	//!< Identifier of the operation if it was obtained from an operation_registry.
+	const registered_operation<T> *registered;	//!< The operation if it was obtained from an operation_registry, \c nullptr otherwise.
+	
+	//!\brief Constructor.
+	//!
+	//!\param f The operation to apply to this branch's children,
+	//!\param l This branch's left child.
+	//!\param r This branch's right child.
+	default_branch(const operation<T>& f, const node_t& l, const node_t& r) : l(l), r(r), f(f), id(unregistered_operation), registered(nullptr) {}
+
+	//!\brief Copy constructor.
+	default_branch(const default_branch_t& other) : branch_base<T, CachingPolicy, ThreadingPolicy>(other), l(other.l), r(other.r) , f(other.f), id(other.id), registered(other.registered) {}
+	
+	virtual ~default_branch() {}
+
+	//! A binary branch has two children.
+	virtual std::size_t arity() const override
+	{
+		return 2;
+	}
+
+	//! Evaluating a branch applies its operation on its children.
+	virtual T evaluate() const override
+	{
+		return ThreadingPolicy::evaluate(f, l, r);
+	}
+
+	//! A branch accounts for itself and its operation separately, then measures its children.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.branches += sizeof(*this) - sizeof(f);
+		m.operations += sizeof(f);
+
+		l.measure(m);
+		r.measure(m);
+	}
+
+	//!\brief This branch's left child.
+	virtual node_t& left()
+	{
+		return l;
+	}
+
+	//!\brief This branch's left child.
+	virtual node_t* operator-()
+	{
+		return &l;
+	}
+	
+	//!\brief This branch's right child.
+	virtual node_t& right()
+	{
+		return r;
+	}
+
+	//!\brief This branch's right child.
+	virtual node_t* operator+()
+	{
+		return &r;
+	}
+};
+
+//!\brief Unary branch class.
+//!
+//! This class stores a unary operation and a single child node.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class unary_branch : public branch_base<T, CachingPolicy, ThreadingPolicy>
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	node_t c;				//!< This branch's child.
+	unary_operation<T> f;	//!< Operation to be applied to this node's child.
+
+protected:
+	//! The only child is child 0.
+	virtual node_t& at(std::size_t) override
+	{
+		return c;
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param f The operation to apply to this branch's child.
+	//!\param c This branch's child.
+	unary_branch(const unary_operation<T>& f, const node_t& c) : c(c), f(f) {}
+
+	//!\brief Copy constructor.
+	unary_branch(const unary_branch& other) : branch_base<T, CachingPolicy, ThreadingPolicy>(other), c(other.c), f(other.f) {}
+
+	virtual ~unary_branch() {}
+
+	//! A unary branch has one child.
+	virtual std::size_t arity() const override
+	{
+		return 1;
+	}
+
+	//! Evaluating a unary branch applies its operation on its child.
+	virtual T evaluate() const override
+	{
+		T t = c.evaluate();
+
+		interruption_point();
+
+		return f(t);
+	}
+
+	//! A branch accounts for itself and its operation separately, then measures its child.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.branches += sizeof(*this) - sizeof(f);
+		m.operations += sizeof(f);
+
+		c.measure(m);
+	}
+};
+
+//!\brief Typed branch class.
+//!
+//! This class stores a functor of type \c O and two children nodes.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy, typename O>
+class typed_branch : public branch_base<T, CachingPolicy, ThreadingPolicy>
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	node_t l;	//!< This branch's left child.
+	node_t r;	//!< This branch's right child.
+	O f;		//!< Operation to be applied to this node's children.
+
+protected:
+	//! The left child is child 0 and the right child is child 1.
+	virtual node_t& at(std::size_t i) override
+	{
+		return i ? r : l;
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param f The operation to apply to this branch's children.
+	//!\param owner The node that owns this branch and is its children's parent.
+	typed_branch(const O& f, node_t *owner) : l(owner), r(owner), f(f) {}
+
+	//!\brief Copy constructor.
+	typed_branch(const typed_branch& other) : branch_base<T, CachingPolicy, ThreadingPolicy>(other), l(other.l), r(other.r), f(other.f) {}
+
+	virtual ~typed_branch() {}
+
+	//! A typed branch has two children.
+	virtual std::size_t arity() const override
+	{
+		return 2;
+	}
+
+	//! Evaluating a typed branch applies its operation on its children, calling the functor directly.
+	virtual T evaluate() const override
+	{
+		return ThreadingPolicy::evaluate(f, l, r);
+	}
+
+	//! A branch accounts for itself and its operation separately, then measures its children.
+	virtual void measure(memory_footprint& m) const override
+	{
+		m.branches += sizeof(*this) - sizeof(f);
+		m.operations += sizeof(f);
+
+		l.measure(m);
+		r.measure(m);
+	}
+};
+
+//!\brief Lazy branch class.
+//!
+//! This class stores a lazy reduction and any number of children nodes.
+//! Children are evaluated on the current thread, only when the reduction asks for their value.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class lazy_branch : public branch_base<T, CachingPolicy, ThreadingPolicy>, lazy_children<T>
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	//!\brief Measurements of a child, kept to reorder children.
+	struct selectivity
+	{
+		std::chrono::nanoseconds cost = std::chrono::nanoseconds(0);	//!< Time spent evaluating the child.
+		std::size_t decisions = 0;										//!< Number of values that settled the result.
+	};
+
+	std::vector<node_t> children;	//!< This branch's children.
+	lazy_reduction<T> f;			//!< Reduction to be applied to this node's children.
+	std::function<bool (const T&)> decides;	//!< Whether a child's value settles the result, if children are interchangeable.
+	std::size_t reorder_period;		//!< Number of evaluations between reorderings, zero to never reorder.
+
+	mutable std::size_t evaluations = 0;			//!< Number of evaluations since the last reordering.
+	mutable std::vector<std::size_t> order;			//!< The child evaluated in each position, if children are reordered.
+	mutable std::vector<selectivity> measurements;	//!< Measurements of each child, if children are reordered.
+
+	//!\brief Sorts children by increasing cost per decision and halves the measurements so recent ones weigh more.
+	void reorder() const
+	{
+		auto rank = [this](std::size_t i)
+		{
+			const selectivity& m = measurements[i];
+
+			return m.decisions ? double(m.cost.count()) / m.decisions : std::numeric_limits<double>::infinity();
+		};
+
+		std::stable_sort(order.begin(), order.end(), [&rank](std::size_t a, std::size_t b){ return rank(a) < rank(b); });
+
+		for(auto& m : measurements)
+		{
+			m.cost /= 2;
+			m.decisions /= 2;
+		}
+	}
+
+protected:
+	//!\brief This branch's \c i th child.
+	virtual node_t& at(std::size_t i) override
+	{
+		return children[i];
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param o The lazy reduction to apply and the number of children to apply it to.
+	//!\param owner The node that owns this branch, which is its children's parent.
+	lazy_branch(const lazy_operation<T>& o, node_t *owner) : children(o.arity, node_t(owner)), f(o.f), decides(o.decides), reorder_period(o.decides ? o.reorder_period : 0)
+	{
+		if(reorder_period)
+		{
+			order.resize(children.size());
+			std::iota(order.begin(), order.end(), 0);
+			measurements.resize(children.size());
+		}
+	}
+
+	//!\brief Copy constructor.
+	lazy_branch(const lazy_branch& other) : branch_base<T, CachingPolicy, ThreadingPolicy>(other), lazy_children<T>(), children(other.children), f(other.f), decides(other.decides), reorder_period(other.reorder_period), evaluations(other.evaluations), order(other.order), measurements(other.measurements) {}
+
+	virtual ~lazy_branch() {}
+
+	//! A lazy branch has as many children as its operation's arity.
+	virtual std::size_t arity() const override
+	{
+		return children.size();
+	}
+
+	//!\brief The number of children.
+	virtual std::size_t size() const override
+	{
+		return children.size();
+	}
+
+	//!\brief Evaluates the child in position \c i.
+	//!
+	//! If children are reordered, the time it takes is measured and whether its value settles the result is recorded.
+	virtual T operator[](std::size_t i) const override
+	{
+		interruption_point();
+
+		if(!reorder_period)
+		{
+			return children[i].evaluate();
+		}
+
+		std::size_t c = order[i];
+
+		auto then = std::chrono::steady_clock::now();
+		T t = children[c].evaluate();
+		measurements[c].cost += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - then);
+
+		if(decides(t))
+		{
+			++measurements[c].decisions;
+		}
+
+		return t;
+	}
+
+	//! Evaluating a lazy branch lets its reduction evaluate the children it needs.
+	//! Every so often, its children may be reordered.
+	virtual T evaluate() const override
+	{
+		T t = f(*this);
+
+		if(reorder_period && ++evaluations == reorder_period)
+		{
+			evaluations = 0;
+			reorder();
+		}
+
+		return t;
 	}
-	
-	//! Because this class stores a pointer to its data, it is not constant.
-	virtual bool constant() const override
+
+	//!\brief The child evaluated in each position.
+	std::vector<std::size_t> evaluation_order() const
 	{
-		return false;
+		if(order.empty())
+		{
+			std::vector<std::size_t> o(children.size());
+			std::iota(o.begin(), o.end(), 0);
+
+			return o;
+		}
+
+		return order;
 	}
-	
-	//! Dereference our pointer.
-	virtual T evaluate() const override
+
+	//! A branch accounts for itself and its children's node objects, its operation separately, then measures its children.
+	virtual void measure(memory_footprint& m) const override
 	{
-		return f();
+		m.branches += sizeof(*this) - sizeof(f) + children.size() * sizeof(node_t) + order.size() * sizeof(std::size_t) + measurements.size() * sizeof(selectivity);
+		m.operations += sizeof(f);
+
+		for(const auto& c : children)
+		{
+			c.measure(m);
+		}
 	}
 };
 
-//!\brief Branch class.
+//!\brief N-ary branch class.
 //!
-//! This class stores an operation and two children nodes.
-//! This default implementation does \a no caching optimization.
+//! This class stores a reduction and any number of children nodes, which are evaluated on the current thread.
+//! The reduction is applied once to all their values.
 template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
-class default_branch : public node_impl<T>
+class nary_branch : public branch_base<T, CachingPolicy, ThreadingPolicy>
 {
-public:
+	//!\brief Holds the values of a branch's children while they are reduced.
+	//!
+	//! Up to \c local values are stored on the stack, so that evaluating most n-ary branches allocates nothing.
+	//! Unlike a \c std::vector<bool>, it stores a whole \c T per value, so it can always be passed as a contiguous array.
+	class values_t
+	{
+		static const std::size_t local = 8;	//!< Number of values stored on the stack.
+
+		alignas(T) unsigned char storage[local * sizeof(T)];	//!< Room for \c local values.
+		std::unique_ptr<unsigned char[]> heap;					//!< Room for more values, if needed.
+		T *values;					//!< Where values are stored.
+		std::size_t count = 0;		//!< Number of values stored.
+
+	public:
+		//!\brief Constructor.
+		//!
+		//!\param capacity The number of values to make room for.
+		values_t(std::size_t capacity) : heap(capacity > local ? new unsigned char[capacity * sizeof(T) + alignof(T)] : nullptr)
+		{
+			void *p = heap ? static_cast<void*>(heap.get()) : static_cast<void*>(storage);
+			std::size_t space = heap ? capacity * sizeof(T) + alignof(T) : sizeof(storage);
+
+			values = static_cast<T*>(std::align(alignof(T), capacity * sizeof(T), p, space));
+		}
+
+		values_t(const values_t&) = delete;
+		values_t& operator=(const values_t&) = delete;
+
+		//!\brief Destroys the values stored so far.
+		~values_t()
+		{
+			while(count)
+			{
+				values[--count].~T();
+			}
+		}
+
+		//!\brief Stores the next value.
+		void push_back(T t)
+		{
+			new(values + count) T(std::move(t));
+			++count;
+		}
+
+		//!\brief The values.
+		const T* data() const
+		{
+			return values;
+		}
+
+		//!\brief The number of values.
+		std::size_t size() const
+		{
+			return count;
+		}
+	};
+
 	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
-	using default_branch_t = default_branch<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
-	
-	node_t l;	//!< This branch's left child.
-	node_t r;	//!< This branch's right child.
-	operation<T> f;	//!< Operation to be applied to this node's children.
-	
-    //!\brief A version of the poor man's tri-state bool.
-    mutable enum constness_e : char { true_, false_, indeterminate } constant_; //!< Caches wether this branch is constant.
-    
+
+	std::vector<node_t> children;	//!< This branch's children.
+	reduction<T> f;					//!< Reduction to be applied to this node's children.
+
+protected:
+	//!\brief This branch's \c i th child.
+	virtual node_t& at(std::size_t i) override
+	{
+		return children[i];
+	}
+
+public:
 	//!\brief Constructor.
 	//!
-	//!\param f The operation to apply to this branch's children,
-	//!\param l This branch's left child.
-	//!\param r This branch's right child.
-	default_branch(const operation<T>& f, const node_t& l, const node_t& r) : l(l), r(r), f(f), constant_(indeterminate) {}
+	//!\param o The reduction to apply and the number of children to apply it to.
+	//!\param owner The node that owns this branch, which is its children's parent.
+	nary_branch(const nary_operation<T>& o, node_t *owner) : children(o.arity, node_t(owner)), f(o.f) {}
 
 	//!\brief Copy constructor.
-	default_branch(const default_branch_t& other) : l(other.l), r(other.r) , f(other.f), constant_(other.constant_) {}
-	
-	virtual ~default_branch() {}
+	nary_branch(const nary_branch& other) : branch_base<T, CachingPolicy, ThreadingPolicy>(other), children(other.children), f(other.f) {}
 
-	//! The constness of a branch is determined by the constness of its children.
-	virtual bool constant() const override
-	{
-        if(constant_ == indeterminate)
-        {
-            constant_ = (l.constant() && r.constant()) ? true_ : false_;
-        }
+	virtual ~nary_branch() {}
 
-		return constant_ == true_;
+	//! An n-ary branch has as many children as its operation's arity.
+	virtual std::size_t arity() const override
+	{
+		return children.size();
 	}
 
-	//! Evaluating a branch applies its operation on its children.
+	//! Evaluating an n-ary branch applies its reduction to its children's values.
+	//! Children are evaluated in order on the current thread, whatever the threading policy.
 	virtual T evaluate() const override
 	{
-		return ThreadingPolicy::evaluate(f, l, r);
-	}
+		values_t values(children.size());
 
-	//!\brief This branch's left child.
-	virtual node_t& left()
-	{
-		return l;
-	}
+		for(const auto& c : children)
+		{
+			values.push_back(c.evaluate());
+		}
 
-	//!\brief This branch's left child.
-	virtual node_t* operator-()
-	{
-		return &l;
-	}
-	
-	//!\brief This branch's right child.
-	virtual node_t& right()
-	{
-		return r;
-	}
+		interruption_point();
 
-	//!\brief This branch's right child.
-	virtual node_t* operator+()
-	{
-		return &r;
+		return f(values.data(), values.size());
 	}
-	
-	//! This function is called when anyone of this branch's children is modified.
-	//! This default implementation does nothing when that happens.
-	virtual void modified()
+
+	//! A branch accounts for itself and its children's node objects, its operation separately, then measures its children.
+	virtual void measure(memory_footprint& m) const override
 	{
-        constant_ = indeterminate;
-        
-		return;
+		m.branches += sizeof(*this) - sizeof(f) + children.size() * sizeof(node_t);
+		m.operations += sizeof(f);
+
+		for(const auto& c : children)
+		{
+			c.measure(m);
+		}
 	}
 };
 
@@ -317,6 +1682,40 @@ class node
 	std::unique_ptr<detail::node_impl<T>> impl;	//!< Follows the pimpl idiom.
 	node_t *parent; //!< This node's parent. Ends up unused when no caching occurs.
 
+	using branch_base_t = detail::branch_base<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	friend struct detail::access;
+
+	//!\brief Makes this node the parent of its implementation's children.
+	void adopt()
+	{
+		if(auto p = dynamic_cast<branch_base_t*>(impl.get()))
+		{
+			for(std::size_t i = 0; i != p->arity(); ++i)
+			{
+				p->child(i).parent = this;
+			}
+		}
+	}
+
+	//!\brief Notifies this node's parent, or this node itself if it is a root, that this node was modified.
+	void notify()
+	{
+		if(parent)
+		{
+			parent->modified();
+		}
+		else
+		{
+			reassigned();
+		}
+	}
+
+protected:
+	//!\brief Called when this node is a root and it or any of its descendants was modified.
+	virtual void reassigned()
+	{}
+
 public:
 	//!\brief Default constructor.
 	//!
@@ -324,7 +1723,21 @@ public:
 	node(node_t *parent = nullptr) : impl(nullptr), parent(parent) {}
 
 	//!\brief Copy constructor.
-	node(const node_t& other) : impl(other.impl ? other.impl->clone() : nullptr), parent(other.parent) {}
+	//!
+	//! The copy's children have the copy as their parent.
+	node(const node_t& other) : impl(other.impl ? other.impl->clone() : nullptr), parent(other.parent)
+	{
+		adopt();
+	}
+
+	//!\brief Move constructor.
+	//!
+	//! The implementation is transferred rather than cloned and its children have the new node as their parent.
+	//! The new node has no parent, even if \c other had one: moving a node out of a tree detaches it.
+	node(node_t&& other) noexcept : impl(std::move(other.impl)), parent(nullptr)
+	{
+		adopt();
+	}
 
 	//!\brief Assignment operator.
 	node_t& operator=(const node_t& other)
@@ -332,18 +1745,77 @@ public:
 		if(this != &other)
 		{
 			impl = other.impl->clone();
-			if(auto p = dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get()))
-			{
-				p->left().parent = p->right().parent = this;
-			}
+			adopt();
+
+			notify();
+		}
+
+		return *this;
+	}
+
+	//!\brief Move assignment operator.
+	//!
+	//! The implementation is transferred rather than cloned and \c other is left empty.
+	//! This is not \c noexcept because parents are notified, which caching-on-assignment branches react to by evaluating.
+	node_t& operator=(node_t&& other)
+	{
+		if(this != &other)
+		{
+			impl = std::move(other.impl);
+			adopt();
+
+			notify();
+		}
+
+		return *this;
+	}
+
+	//!\brief Detaches this node's subtree without cloning it.
+	//!
+	//! This node is left empty and its parents are not notified: the tree must not be evaluated until this node is assigned to again.
+	//!
+	//!\return A node without a parent that owns the subtree.
+	node_t take()
+	{
+		node_t n;
+		n.impl = std::move(impl);
+		n.adopt();
+
+		return n;
+	}
 
-			if(parent)
+	//!\brief Whether this node is \c n or one of its descendants.
+	bool descends_from(const node_t& n) const
+	{
+		for(const node_t *p = this; p; p = p->parent)
+		{
+			if(p == &n)
 			{
-				parent->modified();
+				return true;
 			}
 		}
 
-		return *this;
+		return false;
+	}
+
+	//!\brief Exchanges this node's subtree with another node's, without cloning either.
+	//!
+	//! The nodes may belong to different trees. Each node's parents are notified once.
+	//!
+	//!\throw std::invalid_argument If one node is the other or one of its descendants.
+	void swap(node_t& other)
+	{
+		if(descends_from(other) || other.descends_from(*this))
+		{
+			throw std::invalid_argument("a node can not be swapped with one of its ancestors");
+		}
+
+		std::swap(impl, other.impl);
+		adopt();
+		other.adopt();
+
+		notify();
+		other.notify();
 	}
 
 	virtual ~node()
@@ -357,10 +1829,7 @@ public:
 	{
 		impl.reset(new detail::leaf<T>(t));
 
-		if(parent)
-		{
-			parent->modified();
-		}
+		notify();
 
 		return *this;
 	}
@@ -373,10 +1842,7 @@ public:
 	{
 		impl.reset(new detail::leaf<T*>(t));
 
-		if(parent)
-		{
-			parent->modified();
-		}
+		notify();
 
 		return *this;
 	}
@@ -389,10 +1855,7 @@ public:
 	{
 		impl.reset(new detail::leaf<T (*)()>(f));
 		
-		if(parent)
-		{
-			parent->modified();
-		}
+		notify();
 		
 		return *this;
 	}
@@ -406,11 +1869,89 @@ public:
 		// Create a new branch with the passed operation and two nodes with this node as their parent.
 		impl.reset(new typename CachingPolicy<T, ThreadingPolicy>::branch(f, node<T, CachingPolicy, ThreadingPolicy>(this), node<T, CachingPolicy, ThreadingPolicy>(this)));
 
-		if(parent)
+		notify();
+
+		return *this;
+	}
+
+	//!\brief Assign a registered operation to this node.
+	//!
+	//! Like the assignment of an operation, this designates this node as a branch.
+	//! The branch also remembers the operation's identifier.
+	node_t& operator=(const registered_operation<T>& o)
+	{
+		auto b = new typename CachingPolicy<T, ThreadingPolicy>::branch(o.f, node<T, CachingPolicy, ThreadingPolicy>(this), node<T, CachingPolicy, ThreadingPolicy>(this));
+		b->id = o.id;
+		b->registered = &o;
+		impl.reset(b);
+
+		notify();
+
+		return *this;
+	}
+
+	//!\brief Assign a unary operation to this node.
+	//!
+	//! This designates this node as a branch with a single child, its left one.
+	//! A branch can still be changed to a leaf by assigning data to it.
+	node_t& operator=(const detail::unary_operation<T>& f)
+	{
+		impl.reset(new typename CachingPolicy<T, ThreadingPolicy>::template branch_kind<detail::unary_branch<T, CachingPolicy, ThreadingPolicy>>(f, node_t(this)));
+
+		notify();
+
+		return *this;
+	}
+
+	//!\brief Assign an n-ary operation to this node.
+	//!
+	//! This designates this node as a branch with as many children as the operation's arity.
+	//! A reduction is applied once to the values of all children rather than pairwise.
+	//!\throw std::invalid_argument If the operation's arity is zero.
+	node_t& operator=(const nary_operation<T>& o)
+	{
+		if(o.arity == 0)
 		{
-			parent->modified();
+			throw std::invalid_argument("an n-ary operation must apply to at least one child");
+		}
+
+		impl.reset(new typename CachingPolicy<T, ThreadingPolicy>::template branch_kind<detail::nary_branch<T, CachingPolicy, ThreadingPolicy>>(o, this));
+
+		notify();
+
+		return *this;
+	}
+
+	//!\brief Assign a lazy operation to this node.
+	//!
+	//! This designates this node as a branch with as many children as the operation's arity,
+	//! which are only evaluated when the operation asks for their value.
+	//!\throw std::invalid_argument If the operation's arity is zero.
+	node_t& operator=(const lazy_operation<T>& o)
+	{
+		if(o.arity == 0)
+		{
+			throw std::invalid_argument("a lazy operation must apply to at least one child");
 		}
 
+		impl.reset(new typename CachingPolicy<T, ThreadingPolicy>::template branch_kind<detail::lazy_branch<T, CachingPolicy, ThreadingPolicy>>(o, this));
+
+		notify();
+
+		return *this;
+	}
+
+	//!\brief Assign a typed operation to this node.
+	//!
+	//! This designates this node as a binary branch that calls the operation's functor directly.
+	//! Unlike a branch assigned a detail::operation or a registered_operation, it can not be saved, imaged, pooled, frozen, added to a forest or profiled.
+	template<typename O>
+	node_t& operator=(const typed_operation<T, O>& o)
+	{
+		impl.reset(new typename CachingPolicy<T, ThreadingPolicy>::template branch_kind<detail::typed_branch<T, CachingPolicy, ThreadingPolicy, O>>(o.f, this));
+
+		notify();
+
 		return *this;
 	}
 
@@ -419,31 +1960,66 @@ public:
 	//! Note that if this node is a leaf node, behavior is undefined.
 	node_t& left()
 	{
-		return dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get())->left();
+		return child(0);
+	}
+
+	//!\brief This node's left child.
+	//!
+	//! Note that if this node is a leaf node, behavior is undefined.
+	node_t* operator-()
+	{
+		return &child(0);
+	}
+	
+	//!\brief This node's right child.
+	//!
+	//! Note that if this node is a leaf node, behavior is undefined.
+	node_t& right()
+	{
+		return child(1);
+	}
+
+	//!\brief This node's right child.
+	//!
+	//! Note that if this node is a leaf node, behavior is undefined.
+	node_t* operator+()
+	{
+		return &child(1);
+	}
+
+	//!\brief This node's \c i th child.
+	//!
+	//! Note that if this node is a leaf node or has no such child, behavior is undefined.
+	node_t& child(std::size_t i)
+	{
+		return dynamic_cast<branch_base_t*>(impl.get())->child(i);
 	}
 
-	//!\brief This node's left child.
+	//!\brief The identifier of this branch's registered operation.
 	//!
-	//! Note that if this node is a leaf node, behavior is undefined.
-	node_t* operator-()
+	//!\return unregistered_operation if this node is not a branch assigned a registered_operation.
+	operation_id operation() const
 	{
-		return -*(dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get()));
+		auto b = dynamic_cast<const detail::default_branch<T, CachingPolicy, ThreadingPolicy>*>(impl.get());
+
+		return b ? b->id : unregistered_operation;
 	}
-	
-	//!\brief This node's right child.
+
+	//!\brief The order in which a lazy branch evaluates its children.
 	//!
-	//! Note that if this node is a leaf node, behavior is undefined.
-	node_t& right()
+	//! It only differs from the children's order if the branch's operation reorders them.
+	//! Note that if this node is not a lazy branch, behavior is undefined.
+	std::vector<std::size_t> evaluation_order() const
 	{
-		return dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get())->right();
+		return dynamic_cast<const detail::lazy_branch<T, CachingPolicy, ThreadingPolicy>*>(impl.get())->evaluation_order();
 	}
 
-	//!\brief This node's right child.
-	//!
-	//! Note that if this node is a leaf node, behavior is undefined.
-	node_t* operator+()
+	//!\brief The number of children of this node, zero if it is a leaf node.
+	std::size_t arity() const
 	{
-		return +*(dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get()));
+		auto b = dynamic_cast<const branch_base_t*>(impl.get());
+
+		return b ? b->arity() : 0;
 	}
 	
 	//!\brief Constness of this node.
@@ -458,39 +2034,162 @@ public:
 		return impl->evaluate();
 	}
 
+	//!\brief Evaluates the value of this node unless a stop is requested or a deadline passes first.
+	//!
+	//! Cancellation and the deadline are checked before each branch applies its operation to its children's values, on every thread taking part in the evaluation.
+	//! An interrupted evaluation only caches the values of branches it completed.
+	//!
+	//!\param t Receives the value of this node if the evaluation completes.
+	//!\param token Tells whether to stop.
+	//!\param deadline When to give up.
+	//!\return How the evaluation ended.
+	evaluation_status evaluate(T& t, const stop_token& token, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) const
+	{
+		if(token.stop_requested())
+		{
+			return evaluation_status::cancelled;
+		}
+
+		if(std::chrono::steady_clock::now() >= deadline)
+		{
+			return evaluation_status::timed_out;
+		}
+
+		detail::evaluation_context c(token, deadline);
+		detail::evaluation_context::scope s(&c);
+
+		try
+		{
+			t = impl->evaluate();
+		}
+		catch(const detail::interrupted&)
+		{
+			return c.why();
+		}
+
+		return evaluation_status::completed;
+	}
+
+	//!\brief Adds the memory used by this node's implementation and its children to \c m.
+	void measure(memory_footprint& m) const
+	{
+		if(impl)
+		{
+			impl->measure(m);
+		}
+	}
+
+	//!\brief The memory used by this node's implementation and its children.
+	//!
+	//! The node object itself is not accounted for, as it is owned by its parent or by whoever owns the tree.
+	memory_footprint memory_usage() const
+	{
+		memory_footprint m;
+		measure(m);
+
+		return m;
+	}
+
+	//!\brief Sums the cache counters of this node's branches.
+	//!
+	//! Branches only count when the tree is instantiated with the \link expression_tree::counted counted\endlink threading policy.
+	//! Otherwise, all counts are zero.
+	cache_counters cache_statistics() const
+	{
+		cache_counters c;
+
+		if(auto b = dynamic_cast<const branch_base_t*>(impl.get()))
+		{
+			c += b->cache_statistics();
+
+			for(std::size_t i = 0; i != b->arity(); ++i)
+			{
+				c += b->child(i).cache_statistics();
+			}
+		}
+
+		return c;
+	}
+
 	//!\brief Called when this node is assigned to.
 	//!
 	//! Recursively notifies parent nodes of the growth that happened.
 	void modified()
 	{
-		dynamic_cast<typename CachingPolicy<T, ThreadingPolicy>::branch*>(impl.get())->modified();
+		dynamic_cast<branch_base_t*>(impl.get())->modified();
 
-		if(parent)
-		{
-			parent->modified();
-		}
+		notify();
 	}
 };
 
+//!\brief Exchanges two nodes' subtrees, without cloning either.
+//!
+//!\see node::swap
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void swap(node<T, CachingPolicy, ThreadingPolicy>& a, node<T, CachingPolicy, ThreadingPolicy>& b)
+{
+	a.swap(b);
+}
+
+//!\brief Moves a node's subtree to another node, without cloning it.
+//!
+//! \c dst's parents are notified once. \c src is left empty and its parents are not notified:
+//! its tree must not be evaluated until \c src is assigned to again.
+//!
+//!\param dst The node that receives the subtree. Its former subtree is destroyed.
+//!\param src The node whose subtree is moved. It may be a descendant of \c dst.
+//!\throw std::invalid_argument If \c dst is \c src or one of its descendants.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void splice(node<T, CachingPolicy, ThreadingPolicy>& dst, node<T, CachingPolicy, ThreadingPolicy>&& src)
+{
+	if(dst.descends_from(src))
+	{
+		throw std::invalid_argument("a subtree can not be spliced into itself");
+	}
+
+	dst = std::move(src);
+}
+
 //!\brief Implementation of the CachingPolicy used by tree.
 template<typename T, class ThreadingPolicy>
 struct no_caching
 {
 	using node_t = node<T, expression_tree::no_caching, ThreadingPolicy>;	//!< Convenience alias.
 	using default_branch_t = detail::default_branch<T, expression_tree::no_caching, ThreadingPolicy>;	//!< Convenience alias.
+
+	//!\brief Implementation of a branch of any kind that performs no caching.
+	//!
+	//!\param Base The kind of branch, e.g. detail::nary_branch.
+	template<class Base>
+	class branch_kind : public Base
+	{
+	public:
+		using Base::Base;
+
+		//!\brief Copy constructor.
+		branch_kind(const branch_kind& o) : Base(o) {}
+
+		virtual ~branch_kind() {}
+
+		//!\brief Clones this object.
+		virtual std::unique_ptr<detail::node_impl<T>> clone() const override
+		{
+			return std::make_unique<branch_kind>(*this);
+		}
+	};
 	
 	//!\brief Implementation of a branch class that performs no caching.
 	//!
 	//! This class performs no optimization.
 	//! A non-caching branch will apply its operation on its children whenever it is evaluated.
-	class branch : public default_branch_t
+	class branch : public branch_kind<default_branch_t>
 	{
 	public:
 		//!\brief Default constructor.
-		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : default_branch_t(f, l, r) {}
+		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : branch_kind<default_branch_t>(f, l, r) {}
 
 		//!\brief Copy constructor.
-		branch(const branch& o) : default_branch_t(o) {}
+		branch(const branch& o) : branch_kind<default_branch_t>(o) {}
 
 		virtual ~branch() {}
 		
@@ -509,33 +2208,30 @@ struct cache_on_evaluation
 	using node_t = node<T, expression_tree::cache_on_evaluation, ThreadingPolicy>; //!< Convenience alias.
 	using default_branch_t = detail::default_branch<T, expression_tree::cache_on_evaluation, ThreadingPolicy>;	//!< Convenience alias.
 
-	//!\brief Implementation of a branch class that performs caching on evaluation.
+	//!\brief Implementation of a branch of any kind that performs caching on evaluation.
 	//!
 	//! A caching-on-evaluation branch will apply its operation on its children when it is evaluated
 	//! and cache that value if it is constant (e.g. if its children are of constant value).
-	class branch : public default_branch_t
+	//!
+	//!\param Base The kind of branch, e.g. detail::default_branch.
+	template<class Base>
+	class branch_kind : public Base, detail::cache_counting<ThreadingPolicy>
 	{
-		mutable bool cached;	//!< Whether the value of this node can be considered as cached.
-		mutable T value;		//!< This node's value, if \c cached is \c true.
-
-		using default_branch_t::f;
-		using default_branch_t::l;
-		using default_branch_t::r;
-		using default_branch_t::constant;
+		mutable bool cached = false;	//!< Whether the value of this node can be considered as cached.
+		mutable T value;				//!< This node's value, if \c cached is \c true.
 
 	public:
-		//!\brief Default constructor.
-		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : default_branch_t(f, l, r), cached(false) {}
+		using Base::Base;
 
 		//!\brief Copy constructor.
-		branch(const branch& o) : default_branch_t(o), cached(o.cached), value(o.value) {}
+		branch_kind(const branch_kind& o) : Base(o), detail::cache_counting<ThreadingPolicy>(o), cached(o.cached), value(o.value) {}
 
-		virtual ~branch() {}
+		virtual ~branch_kind() {}
 
 		//!\brief Clones this object.
 		virtual std::unique_ptr<detail::node_impl<T>> clone() const override
 		{
-			return std::make_unique<branch>(*this);
+			return std::make_unique<branch_kind>(*this);
 		}
 
 		//! If the value of this branch has been cached already, return it.
@@ -543,11 +2239,17 @@ struct cache_on_evaluation
 		//! If it is, considered the value as cached to re-use later.
 		virtual T evaluate() const override
 		{
-			if(cached) return value;
+			if(cached)
+			{
+				this->hit();
+				detail::cache_hit<ThreadingPolicy>(this->child(0));
+				return value;
+			}
 
-			value = ThreadingPolicy::evaluate(f, l, r);
+			this->miss();
+			value = Base::evaluate();
 
-			if(constant())
+			if(this->constant())
 			{
 				cached = true;
 			}
@@ -558,10 +2260,49 @@ struct cache_on_evaluation
 		//! When this branch grows (e.g. has its children modified), forget that the value was cached.
 		virtual void modified() override
 		{
-            default_branch_t::modified();
+            Base::modified();
             
+			if(cached)
+			{
+				this->invalidated();
+			}
+
 			cached = false;
 		}
+
+		//!\brief This branch's cache counters.
+		virtual cache_counters cache_statistics() const override
+		{
+			return this->counters();
+		}
+
+		//! The cached value is accounted for with the branch.
+		virtual void measure(memory_footprint& m) const override
+		{
+			Base::measure(m);
+
+			m.branches += sizeof(*this) - sizeof(Base);
+			m.values += detail::heap_size<T>::of(value);
+		}
+	};
+
+	//!\brief Implementation of a branch class that performs caching on evaluation.
+	class branch : public branch_kind<default_branch_t>
+	{
+	public:
+		//!\brief Default constructor.
+		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : branch_kind<default_branch_t>(f, l, r) {}
+
+		//!\brief Copy constructor.
+		branch(const branch& o) : branch_kind<default_branch_t>(o) {}
+
+		virtual ~branch() {}
+
+		//!\brief Clones this object.
+		virtual std::unique_ptr<detail::node_impl<T>> clone() const override
+		{
+			return std::make_unique<branch>(*this);
+		}
 	};
 };
 
@@ -572,54 +2313,63 @@ struct cache_on_assignment
 	using node_t = node<T, expression_tree::cache_on_assignment, ThreadingPolicy>; //!< Convenience alias.
 	using default_branch_t = detail::default_branch<T, expression_tree::cache_on_assignment, ThreadingPolicy>;	//!< Convenience alias.
 
-	//!\brief Implementation of a branch class that performs caching on assignment of its children.
+	//!\brief Implementation of a branch of any kind that performs caching on assignment of its children.
 	//!
 	//! When a caching-on-assignment branch' children are assigned to, the branch checks whether its children
 	//! are constant. If they are, it applies its operation on them and caches that value.
-	class branch : public default_branch_t
+	//!
+	//!\param Base The kind of branch, e.g. detail::default_branch.
+	template<class Base>
+	class branch_kind : public Base, detail::cache_counting<ThreadingPolicy>
 	{
-		mutable bool cached;	//!< Whether the value of this node can be considered as cached.
-		mutable T value;		//!< This node's value, if \c cached is \c true.
-
-		using default_branch_t::f;
-		using default_branch_t::l;
-		using default_branch_t::r;
-		using default_branch_t::constant;
+		mutable bool cached = false;	//!< Whether the value of this node can be considered as cached.
+		mutable T value;				//!< This node's value, if \c cached is \c true.
 
 	public:
-		//!\brief Default constructor.
-		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : default_branch_t(f, l, r), cached(false) {}
+		using Base::Base;
 
 		//!\brief Copy constructor.
-		branch(const branch& o) : default_branch_t(o), cached(o.cached), value(o.value) {}
+		branch_kind(const branch_kind& o) : Base(o), detail::cache_counting<ThreadingPolicy>(o), cached(o.cached), value(o.value) {}
 
-		virtual ~branch() {}
+		virtual ~branch_kind() {}
 
 		//!\brief Clones this object.
 		virtual std::unique_ptr<detail::node_impl<T>> clone() const override
 		{
-			return std::make_unique<branch>(*this);
+			return std::make_unique<branch_kind>(*this);
 		}
 
 		//! If the value of this branch has been cached already, return it.
 		virtual T evaluate() const override
 		{
-			if(cached) return value;
+			if(cached)
+			{
+				this->hit();
+				detail::cache_hit<ThreadingPolicy>(this->child(0));
+				return value;
+			}
 
-			return value = ThreadingPolicy::evaluate(f, l, r);
+			this->miss();
+			return value = Base::evaluate();
 		}
 		
 		//! When this branch has its children modified, check if they are constant.
 		//! If they are, perform the operation and cache the value.
 		virtual void modified() override
 		{
-            default_branch_t::modified();
+            Base::modified();
             
-			if(constant())
+			if(cached)
+			{
+				this->invalidated();
+			}
+
+			if(this->constant())
 			{
 				// If this node is constant, cache its value now.
 				cached = true;
-				value = ThreadingPolicy::evaluate(f, l, r);
+				this->eagerly_evaluated();
+				value = Base::evaluate();
 			}
 			else
 			{
@@ -627,6 +2377,40 @@ struct cache_on_assignment
 				cached = false;
 			}
 		}
+
+		//!\brief This branch's cache counters.
+		virtual cache_counters cache_statistics() const override
+		{
+			return this->counters();
+		}
+
+		//! The cached value is accounted for with the branch.
+		virtual void measure(memory_footprint& m) const override
+		{
+			Base::measure(m);
+
+			m.branches += sizeof(*this) - sizeof(Base);
+			m.values += detail::heap_size<T>::of(value);
+		}
+	};
+
+	//!\brief Implementation of a branch class that performs caching on assignment of its children.
+	class branch : public branch_kind<default_branch_t>
+	{
+	public:
+		//!\brief Default constructor.
+		branch(const detail::operation<T>& f, const node_t& l, const node_t& r) : branch_kind<default_branch_t>(f, l, r) {}
+
+		//!\brief Copy constructor.
+		branch(const branch& o) : branch_kind<default_branch_t>(o) {}
+
+		virtual ~branch() {}
+
+		//!\brief Clones this object.
+		virtual std::unique_ptr<detail::node_impl<T>> clone() const override
+		{
+			return std::make_unique<branch>(*this);
+		}
 	};
 };
 
@@ -643,7 +2427,49 @@ struct cache_on_assignment
 template<typename T, template<typename, typename> class CachingPolicy = no_caching, class ThreadingPolicy = sequential>
 class tree : public node<T, CachingPolicy, ThreadingPolicy>
 {
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+
+	std::uint64_t generation_ = 0;	//!< Number of times this tree was modified.
+
+protected:
+	//!\brief Counts modifications.
+	virtual void reassigned() override
+	{
+		++generation_;
+	}
+
 public:
+	//!\brief Default constructor.
+	tree() = default;
+
+	//!\brief Copy constructor.
+	tree(const tree&) = default;
+
+	//!\brief Move constructor.
+	tree(tree&&) noexcept = default;
+
+	using node_t::operator=;
+
+	//!\brief Assignment operator.
+	//!
+	//! The assignment counts as a modification of this tree, whose generation is kept.
+	tree& operator=(const tree& other)
+	{
+		node_t::operator=(other);
+
+		return *this;
+	}
+
+	//!\brief Move assignment operator.
+	//!
+	//! The assignment counts as a modification of this tree, whose generation is kept.
+	tree& operator=(tree&& other)
+	{
+		node_t::operator=(std::move(other));
+
+		return *this;
+	}
+
 	virtual ~tree() {}
 
 	//!\brief This tree's root node.
@@ -651,6 +2477,14 @@ public:
 	{
 		return *this;
 	}
+
+	//!\brief The number of times this tree, or any of its nodes, was modified.
+	//!
+	//! Anything derived from a tree, such as compiled code, is stale once this changes.
+	std::uint64_t generation() const
+	{
+		return generation_;
+	}
 };
 
 }
@@ -689,7 +2523,7 @@ When your tree is built, call its \link expression_tree::tree::evaluate evaluate
 
 This implementation:
  - requires a C++14 comliant compiler and standard library.
- - is contained in a single header file.
+ - is contained in a single header file. Optional features, such as saving and loading trees, live in their own headers.
  - uses templates heavily.
  - specializes the branches and the leaves to reduce space overhead.
  - requires RTTI.
@@ -699,6 +2533,14 @@ This implementation:
 In order to be evaluated, the tree must be correctly formed.
 That is, all its leaves must have been given a value.
 
+\subsection moving Copying and moving
+
+Copying a node clones its whole subtree. Moving a node, or a tree, transfers its subtree instead and only updates its children's parent.
+\link expression_tree::node::take take \endlink detaches a node's subtree so it can be moved elsewhere,
+as in <tt>n = n.left().take();</tt> which replaces a branch with its left child without any allocation.
+Likewise, \link expression_tree::node::swap swap \endlink exchanges two nodes' subtrees and expression_tree::splice moves one node's subtree to another,
+possibly across trees, notifying the parents of each modified node once.
+
 \section optimizations Optimizations
 
 Two policies are vailable as template parameters to expression_tree::tree.
@@ -804,6 +2646,232 @@ For large enough tree's the hardware limit will be reached and branches will sta
 
 The default policy is \link expression_tree::sequential sequential \endlink which evalutes the tree sequentially.
 
+\subsection interruption Cancellation and deadlines
+
+An evaluation can be bounded by an expression_tree::stop_token, obtained from an expression_tree::stop_source, and by a deadline.
+Rather than returning a value, \link expression_tree::node::evaluate(T&, const stop_token&, std::chrono::steady_clock::time_point) const evaluate \endlink
+then stores it in its first argument and returns an expression_tree::evaluation_status telling whether it completed, was cancelled or timed out.
+Cancellation and the deadline are checked before each branch applies its operation, including on the threads spawned by the \link expression_tree::parallel parallel \endlink policy,
+so an interrupted parallel evaluation winds down promptly.
+
+\subsection profiling Profiling
+
+Header expression_tree_profile.h provides the expression_tree::profiled threading policy, which wraps another threading policy.
+While an expression_tree::profile is started, every branch of a tree instantiated with it records its number of evaluations,
+its number of cache hits and the time spent evaluating it. The profile can then write a report of the tree's branches ranked by exclusive time
+or collapsed stacks for flame graph tools.
+Trees instantiated with other threading policies are not instrumented.
+
+\subsection counters Cache counters
+
+To tell which caching policy suits a workload, instantiate a tree with the expression_tree::counted threading policy, which wraps another threading policy.
+Its caching branches then count their cache hits and misses, the cached values discarded because a child was modified
+and, for caching-on-assignment, the operations applied eagerly upon assignment.
+A node's \link expression_tree::node::cache_statistics cache_statistics \endlink sums the counts of its branches.
+A large number of invalidations relative to hits reveals a tree whose constant parts are modified too often for caching to pay off.
+
+\subsection memory Memory usage
+
+A node's \link expression_tree::node::memory_usage memory_usage \endlink tells how many bytes its implementation and its children use,
+broken down by kind of leaf, branches, operations and heap memory owned by values.
+To count the allocations of node implementations, start an expression_tree::allocation_counter.
+
+\section kinds Kinds of branches
+
+\subsection nary N-ary branches
+
+Assigning an expression_tree::nary_operation to a node makes it a branch with any number of children, accessed with
+\link expression_tree::node::child child \endlink. Its reduction is applied once to the values of all its children, passed as a contiguous array,
+rather than pairwise through a chain of binary branches. expression_tree::sum, expression_tree::product, expression_tree::minimum and expression_tree::maximum
+build common reductions and expression_tree::nary wraps any other. N-ary branches honor the caching policy of their tree,
+but not its threading policy: they evaluate their children in order, on the current thread, so the \link expression_tree::parallel parallel \endlink
+policy does not fork them and expression_tree::profiled does not time them. Up to eight values of children are gathered on the stack,
+so evaluating an n-ary branch usually allocates nothing.
+
+\code
+expression_tree::tree<int> t;
+t.root() = expression_tree::sum<int>(3);
+t.child(0) = 1;
+t.child(1) = &x;
+t.child(2) = 2;
+\endcode
+
+\subsection unary Unary branches
+
+Assigning a unary function object, such as \c std::negate, to a node makes it a branch with a single child, its left one.
+Negations, absolute values, square roots and casts thus cost one branch and one call, without a dummy sibling.
+
+\code
+expression_tree::tree<double> t;
+t.root() = [](const double& d){ return std::sqrt(d); };
+t.left() = &x;
+\endcode
+
+\subsection lazy Lazy branches
+
+Binary, unary and n-ary branches evaluate all their children before applying their operation.
+Assigning an expression_tree::lazy_operation to a node instead makes it a branch whose children are only evaluated when its operation asks for their value.
+expression_tree::if_then_else evaluates its first child and then only one of the other two.
+expression_tree::short_circuit_and and expression_tree::short_circuit_or evaluate their children in order until the result is decided.
+A value counts as true unless it equals a default-constructed value.
+
+Given a reorder period, short-circuiting branches measure how long each child takes to evaluate and how often its value settles the result.
+Every period, they sort their children so that cheap children that often settle the result are evaluated first.
+Only branches of \c bool are reordered: for other types, the first child that settles the result decides its value, so their order must be kept.
+Their \link expression_tree::node::evaluation_order evaluation_order \endlink tells the resulting order.
+
+\code
+expression_tree::tree<bool> t;
+t.root() = expression_tree::short_circuit_and<bool>(2);
+t.child(0) = &cheap_predicate;
+t.child(1) = expensive_predicate;
+\endcode
+
+\subsection typed Typed branches
+
+A branch's operation is a \c std::function, which calls its target indirectly and may allocate to store it.
+Assigning an expression_tree::typed_operation, made by expression_tree::typed, instead makes a binary branch that stores the functor by value
+and calls it directly, so that common operations such as \c std::plus are inlined in the branch's evaluation.
+
+\code
+expression_tree::tree<int> t;
+t.root() = expression_tree::typed<int>(std::plus<int>());
+\endcode
+
+\section registry Registered operations
+
+Operations are opaque callables. To refer to them by identifier, register them in an expression_tree::operation_registry
+and assign the resulting expression_tree::registered_operation to nodes instead of the callable itself.
+Branches built this way remember their operation's identifier.
+
+\code
+expression_tree::operation_registry<int> registry;
+auto& add = registry.add("add", std::plus<int>());
+
+expression_tree::tree<int> t;
+t.root() = add;
+\endcode
+
+\subsection traits Algebraic properties
+
+Registered operations carry expression_tree::operation_traits: whether they are associative, commutative and pure,
+their identity and absorbing elements and a relative cost.
+Those of \c std::plus, \c std::minus, \c std::multiplies and \c std::divides are known; floating point operations are not
+deemed associative since they round. Other operations are assumed to have no property unless they are registered with their traits.
+\link expression_tree::node::operation operation \endlink gives the identifier of a branch's registered operation
+and thus a way to its traits.
+
+\code
+expression_tree::operation_traits<int> traits;
+traits.associative = traits.commutative = traits.pure = true;
+traits.identity_side = expression_tree::side::both;
+traits.identity = std::numeric_limits<int>::min();
+
+auto& maximum = registry.add("max", [](const int& a, const int& b){ return std::max(a, b); }, traits);
+\endcode
+
+\subsection simplification Simplification
+
+Header expression_tree_simplify.h provides expression_tree::simplify, which rewrites a tree according to its operations' traits.
+Identity operations, as in <tt>x * 1</tt>, are replaced with their other operand, absorbing ones, as in <tt>x * 0</tt>, with their absorbing element
+and repeated exact additions, as in <tt>x + x</tt>, with multiplications.
+Subtrees are only discarded if evaluating them has no side effect.
+
+\subsection serialization Saving and loading
+
+Header expression_tree_serialization.h provides expression_tree::save and expression_tree::load.
+A saved tree stores its operations' names once and its nodes in preorder, values in the machine's native byte order.
+Loading a tree is a single sequential read followed by a single construction pass: no modification is propagated up the tree
+as nodes are built, and each branch is notified exactly once.
+Only trees whose branches hold registered operations and whose leaves are constant can be saved.
+
+\subsection image Tree images
+
+Header expression_tree_image.h provides expression_tree::write_image, expression_tree::image_view and expression_tree::mapped_image.
+A tree image is a relocatable layout of a tree: children are referred to by index and leaves' values are stored in a plain array.
+An image is evaluated in place, without being loaded into a tree. When it is memory-mapped from a file, processes share a single copy of it.
+Pointer leaves become variables whose values are passed to \c evaluate.
+
+\subsection parsing Parsing
+
+Header expression_tree_parser.h provides expression_tree::parse, which builds a tree out of an infix expression such as <tt>"2 * a + (b - 3)"</tt>.
+An expression_tree::grammar binds operator symbols to registered operations, with a precedence and an associativity, and names to variables.
+Registered operations can also be called by name, as in <tt>max(a, b)</tt>.
+Nodes are built in a single pass over the expression, each branch being notified once its children are built.
+
+\section streaming Stream evaluation
+
+Header expression_tree_stream.h provides expression_tree::evaluate_csv and expression_tree::evaluate_binary,
+which evaluate a tree once per record of an input stream and write the results to an output stream.
+Each column of a record is bound to a variable that the tree's pointer leaves point to.
+Reading, parsing, evaluation and writing run on separate threads and hand each other blocks of records through bounded queues.
+
+\section forests Forests
+
+Header expression_tree_forest.h provides expression_tree::forest, which evaluates many trees at once.
+Trees added to a forest are merged into a single graph in which identical subtrees, such as branches applying the same registered operation
+to the same children, are stored and evaluated only once. The graph is stored contiguously, in topological order,
+and is evaluated in a single pass that yields the value of every tree.
+
+A forest can also be evaluated on many threads. Each branch then counts its pending children and the thread that evaluates
+its last one goes on to evaluate it, so each vertex is evaluated once, without locks, as soon as its children are.
+
+\section pools Node pools
+
+Header expression_tree_pool.h provides expression_tree::pool_tree, a tree whose nodes are stored in contiguous arrays
+and refer to their parent and children with 32-bit indices rather than pointers.
+Nodes are created bottom-up, each branch out of existing nodes, or copied from a node in postorder.
+A pool node takes 17 bytes plus its payload, which is much less than a node and its implementation, and evaluating a pool walks memory mostly forward.
+
+\section frozen Frozen trees
+
+Header expression_tree_frozen.h provides expression_tree::frozen_tree, a read-only copy of a tree laid out for evaluation.
+Nodes are stored breadth-first, one level after the other, as separate arrays of kinds, payload indices and child indices.
+Evaluation sweeps the levels from the deepest to the root, each level being a contiguous range of nodes read sequentially.
+Variables are still read at evaluation time, so a frozen tree can be evaluated repeatedly as they change.
+
+Given an expression_tree::level_options, evaluation splits each level across threads, which claim chunks of the level's nodes
+and wait for each other before moving on to the next level. Unlike the \link expression_tree::parallel parallel \endlink policy,
+which forks one child per branch, this balances the work of wide trees evenly without creating a task per branch.
+
+\section statics Static trees
+
+Header expression_tree_static.h provides trees whose shape is known at compile time.
+Their nodes are expression_tree::static_constant, expression_tree::static_variable, expression_tree::static_callable
+and expression_tree::static_branch objects, nested in one another by value, so evaluating them calls no virtual function
+nor \c std::function and is inlined by the compiler.
+A branch whose children are both constant applies its operation when it is built and only keeps the result,
+which happens at compile time if the operation can be applied in a constant expression.
+Pointer leaves are read at every evaluation, as in a tree, and \c assign_to builds the equivalent tree in a node.
+
+\code
+int a = 2;
+auto s = expression_tree::make_variable(a) * (expression_tree::make_constant(3) + expression_tree::make_constant(4));
+int v = s.evaluate();	// 14, with 3 + 4 folded.
+\endcode
+
+\section codegen Generated code
+
+Header expression_tree_codegen.h provides expression_tree::codegen, which translates a tree to a C++ function with one statement per node,
+and expression_tree::compiled_tree, which builds that function into a shared object with the installed compiler and loads it.
+Constant leaves become literals, arithmetic operations become operators and other registered operations are given C++ bodies
+through expression_tree::codegen_options. Variables are still read and callables still called at evaluation time.
+A compiled tree evaluates with the generated function as long as its tree's \link expression_tree::tree::generation generation \endlink is unchanged,
+and falls back to the tree's own evaluation if the tree was modified or if generating or building the code failed.
+This relies on POSIX's \c popen and \c dlopen.
+
+\section benchmarks Benchmarks
+
+The \c bench target measures, for \c int, \c double and \c std::string trees of balanced, left-deep, right-deep and random shapes
+and for every combination of caching and threading policies, the time and memory it takes to build a tree and the latency and throughput of its evaluation.
+It prints one CSV line per measurement so results can be tracked from one version to the next:
+
+\verbatim
+bench [leaves [variables [duration]]]
+\endverbatim
+
+where \a leaves is the number of leaves of each tree, one leaf in \a variables is a pointer rather than a constant and each tree is evaluated for at least \a duration seconds.
+
 \section improvements Future improvements
 
  - I'll think of something. I can't help myself.
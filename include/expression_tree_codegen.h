@@ -0,0 +1,511 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_CODEGEN_H)
+     #define EXPRESSION_TREE_CODEGEN_H
+
+#include "expression_tree.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <ios>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace expression_tree
+{
+
+//!\brief Thrown when a tree cannot be translated to C++ or the translation cannot be built.
+class codegen_error : public std::runtime_error
+{
+public:
+	//!\brief Constructor.
+	codegen_error(const std::string& what) : std::runtime_error(what) {}
+};
+
+//!\brief Settings of code generation.
+struct codegen_options
+{
+	std::string compiler = "c++";					//!< The compiler to invoke.
+	std::string flags = "-std=c++14 -O2 -shared -fPIC";	//!< Flags that make the compiler build a shared object.
+	std::string directory = "/tmp";					//!< Where to create the private directory the source and the shared object are written to.
+
+	//!\brief C++ expressions of registered operations that are not arithmetic, by operation name.
+	//!
+	//! Expressions refer to the operands as \c a and \c b, e.g. <tt>a > b ? a : b</tt>.
+	std::unordered_map<std::string, std::string> bodies;
+};
+
+//!\brief Signature of the function generated out of a tree.
+//!
+//! It takes the addresses of the tree's variables, the addresses of its callables and a function that calls one of them.
+template<typename T>
+using generated_function = T (*)(const T* const*, const void* const*, T (*)(const void*));
+
+namespace detail
+{
+
+//!\brief C++ name of \c T.
+template<typename T> const char* type_source() { throw codegen_error("values of this type can not be generated"); }
+template<> inline const char* type_source<bool>() { return "bool"; }
+template<> inline const char* type_source<short>() { return "short"; }
+template<> inline const char* type_source<unsigned short>() { return "unsigned short"; }
+template<> inline const char* type_source<int>() { return "int"; }
+template<> inline const char* type_source<unsigned int>() { return "unsigned int"; }
+template<> inline const char* type_source<long>() { return "long"; }
+template<> inline const char* type_source<unsigned long>() { return "unsigned long"; }
+template<> inline const char* type_source<long long>() { return "long long"; }
+template<> inline const char* type_source<unsigned long long>() { return "unsigned long long"; }
+template<> inline const char* type_source<float>() { return "float"; }
+template<> inline const char* type_source<double>() { return "double"; }
+template<> inline const char* type_source<long double>() { return "long double"; }
+
+//!\brief C++ literal of a value, exactly representing it.
+template<typename T>
+std::string literal_source(const T& t, std::true_type)
+{
+	std::ostringstream s;
+
+	if(std::is_floating_point<T>::value)
+	{
+		if(t != t) return "std::numeric_limits<T>::quiet_NaN()";
+		if(t == std::numeric_limits<T>::infinity()) return "std::numeric_limits<T>::infinity()";
+		if(t == -std::numeric_limits<T>::infinity()) return "-std::numeric_limits<T>::infinity()";
+
+		// Enough digits to read back the same value, suffixed so it is read as a T.
+		s.precision(std::numeric_limits<T>::max_digits10);
+		s << std::scientific << t << (std::is_same<T, float>::value ? "f" : std::is_same<T, long double>::value ? "L" : "");
+	}
+	else if(std::is_signed<T>::value)
+	{
+		// The most negative value has no literal of its own.
+		if(t == std::numeric_limits<T>::min()) return "std::numeric_limits<T>::min()";
+
+		s << "T(" << static_cast<long long>(t) << "LL)";
+	}
+	else
+	{
+		s << "T(" << static_cast<unsigned long long>(t) << "ULL)";
+	}
+
+	return s.str();
+}
+
+//!\brief Values that are not arithmetic have no literal.
+template<typename T>
+std::string literal_source(const T&, std::false_type)
+{
+	throw codegen_error("values of this type can not be generated");
+}
+
+//!\brief Translates a tree to a C++ function, one statement per node.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class generator
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;
+	using default_branch_t = default_branch<T, CachingPolicy, ThreadingPolicy>;
+
+	const operation_registry<T>& registry;	//!< Where operations' names and traits come from.
+	const codegen_options& options;			//!< Where operations' bodies come from.
+
+	std::ostringstream statements;					//!< One statement per node, children before their parents.
+	std::unordered_map<operation_id, bool> defined;	//!< Operations whose function was defined.
+	std::ostringstream functions;					//!< One function per operation.
+	std::size_t values = 0;							//!< Number of statements.
+
+	//!\brief The C++ expression of a registered operation.
+	std::string body(const registered_operation<T>& o) const
+	{
+		switch(o.traits.kind)
+		{
+			case arithmetic::addition: return "a + b";
+			case arithmetic::subtraction: return "a - b";
+			case arithmetic::multiplication: return "a * b";
+			case arithmetic::division: return "a / b";
+			case arithmetic::none: default: break;
+		}
+
+		auto i = options.bodies.find(o.name);
+		if(i == options.bodies.end())
+		{
+			throw codegen_error("operation \"" + o.name + "\" has no body");
+		}
+
+		return i->second;
+	}
+
+public:
+	std::vector<const T*> variables;						//!< The tree's variables, in the order the function reads them.
+	std::vector<const std::function<T ()>*> callables;		//!< The tree's callables, in the order the function calls them.
+
+	//!\brief Constructor.
+	generator(const operation_registry<T>& registry, const codegen_options& options) : registry(registry), options(options) {}
+
+	//!\brief Generates the statement of a node, after those of its children.
+	//!
+	//!\return The index of the node's value.
+	std::size_t generate(const node_t& n)
+	{
+		const auto& impl = access::impl(n);
+
+		if(auto l = dynamic_cast<const leaf<T>*>(impl.get()))
+		{
+			statements << "\tconst T v" << values << " = " << literal_source(l->data(), std::is_arithmetic<T>()) << ";\n";
+		}
+		else if(auto p = dynamic_cast<const leaf<T*>*>(impl.get()))
+		{
+			statements << "\tconst T v" << values << " = *variables[" << variables.size() << "];\n";
+			variables.push_back(p->pointer());
+		}
+		else if(auto c = dynamic_cast<const leaf<T (*)()>*>(impl.get()))
+		{
+			statements << "\tconst T v" << values << " = call(callables[" << callables.size() << "]);\n";
+			callables.push_back(&c->callable());
+		}
+		else if(auto b = dynamic_cast<const default_branch_t*>(impl.get()))
+		{
+			if(!registry.contains(b->registered))
+			{
+				throw codegen_error("only branches with registered operations can be generated");
+			}
+
+			if(!defined[b->id])
+			{
+				functions << "static inline T op" << b->id << "(const T& a, const T& b) { return " << body(registry[b->id]) << "; }\n";
+				defined[b->id] = true;
+			}
+
+			// Right before left, as the sequential policy does, so callables are called in the same order.
+			std::size_t r = generate(b->r);
+			std::size_t l = generate(b->l);
+			statements << "\tconst T v" << values << " = op" << b->id << "(v" << l << ", v" << r << ");\n";
+		}
+		else
+		{
+			throw codegen_error(impl ? "only binary branches can be generated" : "only fully formed trees can be generated");
+		}
+
+		return values++;
+	}
+
+	//!\brief The translation unit defining \c expression_tree_evaluate.
+	std::string source() const
+	{
+		std::ostringstream s;
+
+		s << "#include <limits>\n\n"
+		  << "typedef " << type_source<T>() << " T;\n\n"
+		  << functions.str() << '\n'
+		  << "extern \"C\" T expression_tree_evaluate(const T* const* variables, const void* const* callables, T (*call)(const void*))\n"
+		  << "{\n"
+		  << "\t(void)variables; (void)callables; (void)call;\n"
+		  << statements.str()
+		  << "\treturn v" << values - 1 << ";\n"
+		  << "}\n";
+
+		return s.str();
+	}
+};
+
+//!\brief Quotes a string for the shell.
+inline std::string shell_quote(const std::string& s)
+{
+	std::string q = "'";
+
+	for(char c : s)
+	{
+		if(c == '\'')
+		{
+			q += "'\\''";
+		}
+		else
+		{
+			q += c;
+		}
+	}
+
+	return q + "'";
+}
+
+//!\brief A directory only the current user can access, removed with its files when destroyed.
+class private_directory
+{
+	std::string path_;					//!< The directory.
+	std::vector<std::string> files;		//!< Files to remove with it.
+
+public:
+	//!\brief Creates a uniquely named directory in \c parent, with mode 0700.
+	//!
+	//!\throw codegen_error If the directory can not be created.
+	private_directory(const std::string& parent)
+	{
+		std::string base = parent + "/expression_tree_XXXXXX";
+		std::vector<char> name(base.begin(), base.end());
+		name.push_back('\0');
+
+		if(!mkdtemp(name.data()))
+		{
+			throw codegen_error("can not create a directory in " + parent);
+		}
+
+		path_ = name.data();
+	}
+
+	private_directory(const private_directory&) = delete;
+	private_directory& operator=(const private_directory&) = delete;
+
+	//!\brief Removes the files and the directory.
+	~private_directory()
+	{
+		for(const auto& f : files)
+		{
+			unlink(f.c_str());
+		}
+
+		rmdir(path_.c_str());
+	}
+
+	//!\brief The path of file \c name in this directory, which is removed along with it.
+	std::string file(const std::string& name)
+	{
+		files.push_back(path_ + '/' + name);
+
+		return files.back();
+	}
+};
+
+//!\brief Calls a callable leaf's callable on behalf of generated code.
+template<typename T>
+T call(const void *f)
+{
+	return (*static_cast<const std::function<T ()>*>(f))();
+}
+
+}
+
+//!\brief Translates a tree to C++.
+//!
+//! The result defines <tt>extern "C" T expression_tree_evaluate(...)</tt>, whose signature is generated_function.
+//! Constant leaves become literals, so the compiler can fold constant subtrees.
+//!
+//!\param n The node to translate, typically a tree's root.
+//!\param registry Where the branches' operations were obtained. Arithmetic operations are translated to operators.
+//!\param options Where the bodies of other operations come from.
+//!\throw codegen_error If \c T is not arithmetic, if a branch is not binary or its operation not registered or if an operation has no body.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::string codegen(const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry, const codegen_options& options = codegen_options())
+{
+	detail::generator<T, CachingPolicy, ThreadingPolicy> g(registry, options);
+	g.generate(n);
+
+	return g.source();
+}
+
+//!\brief Evaluates a tree with native code generated out of it.
+//!
+//! On construction, the tree is translated to C++ and built into a shared object, which is loaded.
+//! Evaluation then calls the generated function as long as the tree is not modified.
+//! If generation or building failed, or once the tree is modified, evaluation falls back to the tree's own.
+//! Call \c compile again to generate code for the modified tree.
+template<typename T, template<typename, typename> class CachingPolicy = no_caching, class ThreadingPolicy = sequential>
+class compiled_tree
+{
+	using tree_t = tree<T, CachingPolicy, ThreadingPolicy>;
+
+	const tree_t& t;						//!< The tree.
+	const operation_registry<T>& registry;	//!< Where the tree's operations were obtained.
+	codegen_options options;				//!< Settings of code generation.
+
+	void *handle = nullptr;					//!< The loaded shared object.
+	generated_function<T> f = nullptr;		//!< The generated function.
+	std::uint64_t generation = 0;			//!< The tree's generation when it was compiled.
+	std::vector<const T*> variables;		//!< Addresses of the tree's variables.
+	std::vector<const void*> callables;		//!< Addresses of the tree's callables.
+	std::string diagnostic_;				//!< Why the last compilation failed.
+
+	//!\brief Unloads the shared object.
+	void unload()
+	{
+		f = nullptr;
+
+		if(handle)
+		{
+			dlclose(handle);
+			handle = nullptr;
+		}
+	}
+
+	//!\brief Generates, builds and loads code for the tree.
+	void build()
+	{
+		detail::generator<T, CachingPolicy, ThreadingPolicy> g(registry, options);
+		g.generate(t);
+
+		// Files live in a directory no one else can write to, so no one can substitute them.
+		detail::private_directory directory(options.directory);
+		std::string source = directory.file("tree.cpp"), object = directory.file("tree.so");
+
+		int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+		if(fd == -1)
+		{
+			throw codegen_error("can not write " + source);
+		}
+
+		std::string s = g.source();
+		bool written = write(fd, s.data(), s.size()) == static_cast<ssize_t>(s.size());
+		close(fd);
+
+		if(!written)
+		{
+			throw codegen_error("can not write " + source);
+		}
+
+		std::string command = detail::shell_quote(options.compiler) + ' ' + options.flags + " -o " + detail::shell_quote(object) + ' ' + detail::shell_quote(source) + " 2>&1";
+		std::string output;
+
+		FILE *compiler = popen(command.c_str(), "r");
+		if(compiler)
+		{
+			char buffer[256];
+			while(std::size_t read = std::fread(buffer, 1, sizeof(buffer), compiler))
+			{
+				output.append(buffer, read);
+			}
+		}
+
+		int status = compiler ? pclose(compiler) : -1;
+
+		if(status != 0)
+		{
+			throw codegen_error(command + " failed: " + output);
+		}
+
+		handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+		if(!handle)
+		{
+			const char *error = dlerror();
+			throw codegen_error(error ? error : "can not load " + object);
+		}
+
+		f = reinterpret_cast<generated_function<T>>(dlsym(handle, "expression_tree_evaluate"));
+		if(!f)
+		{
+			unload();
+			throw codegen_error("generated function not found");
+		}
+
+		variables = g.variables;
+		callables.assign(g.callables.begin(), g.callables.end());
+	}
+
+public:
+	//!\brief Constructor. Compiles the tree.
+	//!
+	//!\param t The tree. It must outlive this object.
+	//!\param registry Where the tree's operations were obtained. It must outlive this object.
+	//!\param options Settings of code generation.
+	compiled_tree(const tree_t& t, const operation_registry<T>& registry, const codegen_options& options = codegen_options()) : t(t), registry(registry), options(options)
+	{
+		compile();
+	}
+
+	compiled_tree(const compiled_tree&) = delete;
+	compiled_tree& operator=(const compiled_tree&) = delete;
+
+	//!\brief Destructor. Unloads the generated code.
+	~compiled_tree()
+	{
+		unload();
+	}
+
+	//!\brief Generates, builds and loads code for the tree as it currently is.
+	//!
+	//!\return Whether it succeeded. If not, \c diagnostic tells why.
+	bool compile()
+	{
+		unload();
+		diagnostic_.clear();
+
+		try
+		{
+			build();
+			generation = t.generation();
+		}
+		catch(const codegen_error& e)
+		{
+			diagnostic_ = e.what();
+		}
+
+		return f != nullptr;
+	}
+
+	//!\brief Whether evaluation calls generated code, i.e. compilation succeeded and the tree was not modified since.
+	bool compiled() const
+	{
+		return f && generation == t.generation();
+	}
+
+	//!\brief Why the last compilation failed, empty if it succeeded.
+	const std::string& diagnostic() const
+	{
+		return diagnostic_;
+	}
+
+	//!\brief Evaluates the tree, with generated code if it is up to date.
+	T evaluate() const
+	{
+		if(!compiled())
+		{
+			return t.evaluate();
+		}
+
+		return f(variables.data(), callables.data(), &detail::call<T>);
+	}
+};
+
+}
+
+#endif
+
+/*!
+\file expression_tree_codegen.h
+\brief Evaluation of trees with native code generated out of them, on POSIX systems.
+*/
@@ -0,0 +1,524 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+
+#if !defined(EXPRESSION_TREE_FOREST_H)
+     #define EXPRESSION_TREE_FOREST_H
+
+#include "expression_tree.h"
+#include "expression_tree_workers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace expression_tree
+{
+
+namespace detail
+{
+
+//!\brief Bytes that identify a constant value, if constant values of type \c T can be compared.
+//!
+//! This default implementation uses the value's bytes and thus applies to trivially copyable types.
+template<typename T, typename = void>
+struct constant_key
+{
+	static const bool comparable = false;	//!< Whether values of type \c T can be compared.
+
+	//!\brief The key of \c t.
+	static std::string of(const T&)
+	{
+		return std::string();
+	}
+};
+
+//!\brief Trivially copyable values are compared by their bytes.
+template<typename T>
+struct constant_key<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+	static const bool comparable = true;	//!< Whether values of type \c T can be compared.
+
+	//!\brief The key of \c t.
+	static std::string of(const T& t)
+	{
+		return std::string(reinterpret_cast<const char*>(&t), sizeof(T));
+	}
+};
+
+//!\brief Strings are compared by their characters.
+template<typename C, typename Traits, typename Allocator>
+struct constant_key<std::basic_string<C, Traits, Allocator>>
+{
+	static const bool comparable = true;	//!< Whether values of this type can be compared.
+
+	//!\brief The key of \c s.
+	static std::string of(const std::basic_string<C, Traits, Allocator>& s)
+	{
+		return std::string(reinterpret_cast<const char*>(s.data()), s.size() * sizeof(C));
+	}
+};
+
+}
+
+//!\brief Evaluates many trees at once, sharing the work their common subexpressions represent.
+//!
+//! Trees added to a forest are merged into a single directed acyclic graph whose vertices are stored in topological order.
+//! Two subtrees are merged when they are structurally identical:
+//! - constant leaves of equal value,
+//! - pointer leaves that point to the same variable,
+//! - branches whose registered operation is pure and whose children are the same.
+//!
+//! Branches whose operation was not obtained from the forest's registry or is not pure, and callable leaves, are never merged.
+//! A forest is a snapshot: modifying a tree after it was added does not modify the forest.
+template<typename T>
+class forest
+{
+public:
+	//!\brief Kinds of vertices.
+	enum class kind : std::uint8_t
+	{
+		constant,	//!< A leaf with a constant value.
+		pointer,	//!< A leaf pointing to a variable.
+		callable,	//!< A leaf holding a callable.
+		branch		//!< A branch.
+	};
+
+	//!\brief A vertex of the graph.
+	struct vertex
+	{
+		forest::kind kind;		//!< The kind of this vertex.
+		std::uint32_t index;	//!< Index of this vertex' value, pointer, callable or operation.
+		std::uint32_t left;		//!< A branch's left child.
+		std::uint32_t right;	//!< A branch's right child.
+	};
+
+private:
+	//!\brief Hashes a branch' operation and children.
+	struct branch_hash
+	{
+		std::size_t operator()(const std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>& b) const
+		{
+			return std::hash<std::uint64_t>()((std::uint64_t(std::get<0>(b)) << 42) ^ (std::uint64_t(std::get<1>(b)) << 21) ^ std::get<2>(b));
+		}
+	};
+
+	const operation_registry<T>& registry;	//!< Where shared operations come from.
+
+	std::vector<vertex> vertices;						//!< The graph, children before their parents.
+	std::vector<std::uint32_t> roots_;					//!< The vertex of each tree, in the order they were added.
+	std::vector<T> constants;							//!< Values of constant leaves.
+	std::vector<const T*> pointers;						//!< Pointers of pointer leaves.
+	std::vector<std::function<T ()>> callables;			//!< Callables of callable leaves.
+	std::vector<const detail::operation<T>*> operations;	//!< Operations of branches.
+	std::vector<std::unique_ptr<detail::operation<T>>> unregistered;	//!< Copies of operations that were not registered.
+
+	std::unordered_map<std::string, std::uint32_t> constant_vertices;	//!< Vertices of constant leaves by value.
+	std::unordered_map<const T*, std::uint32_t> pointer_vertices;		//!< Vertices of pointer leaves by pointer.
+	std::unordered_map<operation_id, std::uint32_t> registered;			//!< Indices of registered operations by identifier.
+	std::unordered_map<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>, std::uint32_t, branch_hash> branch_vertices;	//!< Vertices of branches by operation and children.
+
+	//!\brief Appends a vertex and returns its index.
+	std::uint32_t push(kind k, std::uint32_t index, std::uint32_t left = 0, std::uint32_t right = 0)
+	{
+		vertices.push_back({k, index, left, right});
+
+		return static_cast<std::uint32_t>(vertices.size() - 1);
+	}
+
+	//!\brief Merges a branch whose children are already merged into the graph.
+	//!
+	//!\param f The branch's operation.
+	//!\param r The branch's registered operation, if any.
+	//!\return The vertex of the branch.
+	std::uint32_t merge(const detail::operation<T>& f, const registered_operation<T> *r, std::uint32_t left, std::uint32_t right)
+	{
+		if(!registry.contains(r))
+		{
+			unregistered.push_back(std::make_unique<detail::operation<T>>(f));
+			operations.push_back(unregistered.back().get());
+
+			return push(kind::branch, static_cast<std::uint32_t>(operations.size() - 1), left, right);
+		}
+
+		auto o = registered.emplace(r->id, static_cast<std::uint32_t>(operations.size()));
+		if(o.second)
+		{
+			operations.push_back(&r->f);
+		}
+
+		// An impure operation may not give the same value twice for the same operands, so each of its branches is evaluated.
+		if(!r->traits.pure)
+		{
+			return push(kind::branch, o.first->second, left, right);
+		}
+
+		auto i = branch_vertices.emplace(std::make_tuple(o.first->second, left, right), 0);
+		if(i.second)
+		{
+			i.first->second = push(kind::branch, o.first->second, left, right);
+		}
+
+		return i.first->second;
+	}
+
+	//!\brief Merges a node and its children into the graph.
+	//!
+	//! Nodes are visited in postorder with an explicit stack, so the depth of a tree is not limited by that of the call stack.
+	//!
+	//!\return The vertex of the node.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	std::uint32_t merge(const node<T, CachingPolicy, ThreadingPolicy>& n)
+	{
+		using branch_t = detail::default_branch<T, CachingPolicy, ThreadingPolicy>;
+
+		// Nodes yet to merge. A branch is stacked a second time, as null, below its children and is merged once they are.
+		std::vector<std::pair<const node<T, CachingPolicy, ThreadingPolicy>*, const branch_t*>> pending{{&n, nullptr}};
+		std::vector<std::uint32_t> merged;
+
+		while(!pending.empty())
+		{
+			auto top = pending.back();
+			pending.pop_back();
+
+			if(const branch_t *b = top.second)
+			{
+				std::uint32_t right = merged.back();
+				merged.pop_back();
+
+				merged.back() = merge(b->f, b->registered, merged.back(), right);
+
+				continue;
+			}
+
+			const auto& impl = detail::access::impl(*top.first);
+
+			if(auto l = dynamic_cast<const detail::leaf<T>*>(impl.get()))
+			{
+				if(!detail::constant_key<T>::comparable)
+				{
+					constants.push_back(l->data());
+					merged.push_back(push(kind::constant, static_cast<std::uint32_t>(constants.size() - 1)));
+
+					continue;
+				}
+
+				auto i = constant_vertices.emplace(detail::constant_key<T>::of(l->data()), 0);
+				if(i.second)
+				{
+					constants.push_back(l->data());
+					i.first->second = push(kind::constant, static_cast<std::uint32_t>(constants.size() - 1));
+				}
+
+				merged.push_back(i.first->second);
+			}
+			else if(auto p = dynamic_cast<const detail::leaf<T*>*>(impl.get()))
+			{
+				auto i = pointer_vertices.emplace(p->pointer(), 0);
+				if(i.second)
+				{
+					pointers.push_back(p->pointer());
+					i.first->second = push(kind::pointer, static_cast<std::uint32_t>(pointers.size() - 1));
+				}
+
+				merged.push_back(i.first->second);
+			}
+			else if(auto c = dynamic_cast<const detail::leaf<T (*)()>*>(impl.get()))
+			{
+				callables.push_back(c->callable());
+
+				merged.push_back(push(kind::callable, static_cast<std::uint32_t>(callables.size() - 1)));
+			}
+			else if(auto b = dynamic_cast<const branch_t*>(impl.get()))
+			{
+				pending.push_back({nullptr, b});
+				pending.push_back({&b->r, nullptr});
+				pending.push_back({&b->l, nullptr});
+			}
+			else
+			{
+				throw std::invalid_argument("only fully formed trees can be added to a forest");
+			}
+		}
+
+		return merged.back();
+	}
+
+	//!\brief Computes the value of vertex \c i, whose children's values are already in \c values.
+	T value(std::uint32_t i, const T *values) const
+	{
+		const vertex& v = vertices[i];
+
+		switch(v.kind)
+		{
+			case kind::constant:
+				return constants[v.index];
+
+			case kind::pointer:
+				return *pointers[v.index];
+
+			case kind::callable:
+				return callables[v.index]();
+
+			case kind::branch:
+			default:
+				return (*operations[v.index])(values[v.left], values[v.right]);
+		}
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param registry Where the operations of branches that may be shared come from. It must outlive this forest.
+	forest(const operation_registry<T>& registry) : registry(registry) {}
+
+	//!\brief Adds a tree to this forest.
+	//!
+	//!\param n The node to add, typically a tree's root.
+	//!\return The index of the tree's value in the results of evaluate.
+	//!\throw std::invalid_argument If the tree has a node that was never assigned to.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	std::size_t add(const node<T, CachingPolicy, ThreadingPolicy>& n)
+	{
+		roots_.push_back(merge(n));
+
+		return roots_.size() - 1;
+	}
+
+	//!\brief Evaluates all trees in a single pass over the graph.
+	//!
+	//!\param results Receives the value of each tree, in the order they were added.
+	void evaluate(std::vector<T>& results) const
+	{
+		std::unique_ptr<T[]> values(new T[vertices.size()]);
+
+		for(std::uint32_t i = 0; i != vertices.size(); ++i)
+		{
+			values[i] = value(i, values.get());
+		}
+
+		results.clear();
+		for(auto r : roots_)
+		{
+			results.push_back(values[r]);
+		}
+	}
+
+	//!\brief Evaluates all trees on many threads, each vertex once.
+	//!
+	//! Each branch counts the children whose value is still pending.
+	//! Leaves are ready from the start and a branch becomes ready when its last pending child is evaluated,
+	//! so shared vertices are evaluated once, without locks, and parallelism is only bounded by the width of the graph.
+	//! The thread that makes a branch ready goes on to evaluate it.
+	//! Threads are taken from a pool that lives across evaluations. Concurrent and nested evaluations each get threads of their own; fewer are used only if threads can not be started.
+	//!
+	//!\param results Receives the value of each tree, in the order they were added.
+	//!\param threads Number of threads, the calling one included. Zero means as many as the hardware supports.
+	void evaluate(std::vector<T>& results, std::size_t threads) const
+	{
+		if(!threads)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		detail::workers crew(vertices.empty() ? 1 : threads);
+		if(crew.size() == 1)
+		{
+			evaluate(results);
+			return;
+		}
+
+		// The branches each vertex is a child of, once per edge.
+		std::vector<std::uint32_t> first(vertices.size() + 1, 0), parents;
+		for(const auto& v : vertices)
+		{
+			if(v.kind == kind::branch)
+			{
+				++first[v.left + 1];
+				++first[v.right + 1];
+			}
+		}
+		for(std::size_t i = 1; i != first.size(); ++i)
+		{
+			first[i] += first[i - 1];
+		}
+
+		parents.resize(first.back());
+		std::vector<std::uint32_t> filled(first.begin(), first.end() - 1);
+		std::unique_ptr<std::atomic<std::uint32_t>[]> pending(new std::atomic<std::uint32_t>[vertices.size()]);
+		std::vector<std::uint32_t> ready;
+
+		for(std::uint32_t i = 0; i != vertices.size(); ++i)
+		{
+			const vertex& v = vertices[i];
+
+			if(v.kind == kind::branch)
+			{
+				parents[filled[v.left]++] = i;
+				parents[filled[v.right]++] = i;
+				pending[i] = 2;
+			}
+			else
+			{
+				pending[i] = 0;
+				ready.push_back(i);
+			}
+		}
+
+		// Not a std::vector, which packs bools into shared words that threads could not write concurrently.
+		std::unique_ptr<T[]> values(new T[vertices.size()]);
+		std::mutex m;
+		std::condition_variable cv;
+		std::size_t remaining = vertices.size();
+		std::exception_ptr error;
+
+		auto work = [&]
+		{
+			std::unique_lock<std::mutex> lock(m);
+
+			while(true)
+			{
+				cv.wait(lock, [&]{ return !ready.empty() || !remaining || error; });
+				if(!remaining || error) return;
+
+				std::uint32_t i = ready.back();
+				ready.pop_back();
+				lock.unlock();
+
+				std::size_t done = 0;
+				std::vector<std::uint32_t> woken;
+
+				try
+				{
+					// Evaluate this vertex and, as long as it makes one of its parents ready, that parent.
+					while(true)
+					{
+						values[i] = value(i, values.get());
+						++done;
+
+						std::uint32_t next = static_cast<std::uint32_t>(vertices.size());
+						for(std::uint32_t p = first[i]; p != first[i + 1]; ++p)
+						{
+							if(pending[parents[p]].fetch_sub(1, std::memory_order_acq_rel) == 1)
+							{
+								if(next == vertices.size()) next = parents[p];
+								else woken.push_back(parents[p]);
+							}
+						}
+
+						if(!woken.empty())
+						{
+							std::lock_guard<std::mutex> guard(m);
+							ready.insert(ready.end(), woken.begin(), woken.end());
+							woken.clear();
+							cv.notify_all();
+						}
+
+						if(next == vertices.size()) break;
+						i = next;
+					}
+				}
+				catch(...)
+				{
+					lock.lock();
+					if(!error) error = std::current_exception();
+					cv.notify_all();
+					return;
+				}
+
+				lock.lock();
+				remaining -= done;
+				if(!remaining) cv.notify_all();
+			}
+		};
+
+		crew.run(work);
+
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+
+		results.clear();
+		for(auto r : roots_)
+		{
+			results.push_back(values[r]);
+		}
+	}
+
+	//!\brief Evaluates all trees in a single pass over the graph.
+	//!
+	//!\return The value of each tree, in the order they were added.
+	std::vector<T> evaluate() const
+	{
+		std::vector<T> results;
+		evaluate(results);
+
+		return results;
+	}
+
+	//!\brief The number of trees in this forest.
+	std::size_t size() const
+	{
+		return roots_.size();
+	}
+
+	//!\brief The vertices of the graph, children before their parents.
+	const std::vector<vertex>& graph() const
+	{
+		return vertices;
+	}
+
+	//!\brief The vertex of each tree, in the order they were added.
+	const std::vector<std::uint32_t>& roots() const
+	{
+		return roots_;
+	}
+};
+
+}
+
+#endif
+
+/*!
+\file expression_tree_forest.h
+\brief Evaluation of many trees at once with their common subexpressions merged.
+*/
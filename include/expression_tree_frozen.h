@@ -0,0 +1,453 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_FROZEN_H)
+     #define EXPRESSION_TREE_FROZEN_H
+
+#include "expression_tree.h"
+#include "expression_tree_workers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief Tuning of level-synchronous parallel evaluation.
+struct level_options
+{
+	std::size_t threads = 0;	//!< Number of threads, the calling one included. Zero means as many as the hardware supports.
+	std::size_t chunk = 1024;	//!< Number of nodes of a level a thread evaluates at once.
+};
+
+namespace detail
+{
+
+//!\brief Blocks a fixed number of threads until all of them have arrived.
+class barrier
+{
+	std::mutex m;
+	std::condition_variable cv;
+	std::size_t count;				//!< Number of threads to wait for.
+	std::size_t waiting = 0;		//!< Number of threads that have arrived.
+	std::size_t generation = 0;		//!< Incremented every time all threads have arrived.
+
+public:
+	//!\brief Constructor.
+	barrier(std::size_t count) : count(count) {}
+
+	//!\brief Waits for all threads to arrive.
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m);
+
+		std::size_t g = generation;
+		if(++waiting == count)
+		{
+			waiting = 0;
+			++generation;
+			cv.notify_all();
+		}
+		else
+		{
+			cv.wait(lock, [this, g]{ return generation != g; });
+		}
+	}
+};
+
+}
+
+//!\brief The value of every node of a frozen_tree, kept across evaluations to save its allocation.
+//!
+//! Unlike a \c std::vector<bool>, it stores a whole \c T per node, even for \c bool, so that threads can write neighbouring values concurrently.
+template<typename T>
+class node_values
+{
+	std::unique_ptr<T[]> values;	//!< One value per node.
+	std::size_t count = 0;			//!< Number of values.
+
+public:
+	//!\brief Makes room for \c n values. Nothing is allocated if there already are \c n of them.
+	void resize(std::size_t n)
+	{
+		if(n != count)
+		{
+			values.reset(new T[n]);
+			count = n;
+		}
+	}
+
+	//!\brief The number of values.
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	//!\brief The value of node \c i.
+	const T& operator[](std::size_t i) const
+	{
+		return values[i];
+	}
+
+	//!\brief The values.
+	T* data()
+	{
+		return values.get();
+	}
+};
+
+//!\brief A read-only copy of a tree laid out for fast evaluation.
+//!
+//! Nodes are stored breadth-first, level by level, as a structure of arrays: kinds, payload indices and child indices
+//! each live in their own array. Because siblings are stored next to each other, a branch only stores the index of its left child,
+//! its right child being the next node.
+//! Evaluation sweeps the levels from the deepest to the root, each level being a contiguous range of nodes whose children
+//! all belong to the next level.
+//! Pointer and callable leaves are still read at evaluation time, but the tree's structure and constants can no longer be modified.
+template<typename T>
+class frozen_tree
+{
+public:
+	//!\brief Kinds of nodes.
+	enum class kind : std::uint8_t
+	{
+		constant,	//!< A leaf with a constant value.
+		pointer,	//!< A leaf pointing to a variable.
+		callable,	//!< A leaf holding a callable.
+		branch		//!< A branch.
+	};
+
+private:
+	std::vector<kind> kinds;				//!< The kind of each node.
+	std::vector<std::uint32_t> data;		//!< Index of each node's value, pointer, callable or operation.
+	std::vector<std::uint32_t> children;	//!< Index of each branch's left child. Its right child follows it.
+	std::vector<std::uint32_t> levels;		//!< Index of the first node of each level, followed by the number of nodes.
+
+	std::vector<T> constants;							//!< Values of constant leaves.
+	std::vector<const T*> pointers;						//!< Pointers of pointer leaves.
+	std::vector<std::function<T ()>> callables;			//!< Callables of callable leaves.
+	std::vector<const detail::operation<T>*> operations;	//!< Operations of branches.
+	std::vector<std::unique_ptr<detail::operation<T>>> unregistered;	//!< Copies of operations that were not registered.
+
+	//!\brief Appends a node.
+	void push(kind k, std::size_t index, std::uint32_t child = 0)
+	{
+		kinds.push_back(k);
+		data.push_back(static_cast<std::uint32_t>(index));
+		children.push_back(child);
+	}
+
+	//!\brief Lays out a tree level by level.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	void freeze(const node<T, CachingPolicy, ThreadingPolicy>& root, const operation_registry<T> *registry)
+	{
+		using node_t = node<T, CachingPolicy, ThreadingPolicy>;
+
+		std::vector<const node_t*> level{&root}, next;
+
+		while(!level.empty())
+		{
+			if(kinds.size() + level.size() >= std::numeric_limits<std::uint32_t>::max())
+			{
+				throw std::length_error("a frozen_tree can hold at most 2^32 - 1 nodes");
+			}
+
+			levels.push_back(static_cast<std::uint32_t>(kinds.size()));
+			std::uint32_t first = static_cast<std::uint32_t>(kinds.size() + level.size());
+
+			for(const node_t *n : level)
+			{
+				const auto& impl = detail::access::impl(*n);
+
+				if(auto l = dynamic_cast<const detail::leaf<T>*>(impl.get()))
+				{
+					constants.push_back(l->data());
+					push(kind::constant, constants.size() - 1);
+				}
+				else if(auto p = dynamic_cast<const detail::leaf<T*>*>(impl.get()))
+				{
+					pointers.push_back(p->pointer());
+					push(kind::pointer, pointers.size() - 1);
+				}
+				else if(auto c = dynamic_cast<const detail::leaf<T (*)()>*>(impl.get()))
+				{
+					callables.push_back(c->callable());
+					push(kind::callable, callables.size() - 1);
+				}
+				else if(auto b = dynamic_cast<const detail::default_branch<T, CachingPolicy, ThreadingPolicy>*>(impl.get()))
+				{
+					if(registry && registry->contains(b->registered))
+					{
+						operations.push_back(&b->registered->f);
+					}
+					else
+					{
+						unregistered.push_back(std::make_unique<detail::operation<T>>(b->f));
+						operations.push_back(unregistered.back().get());
+					}
+
+					push(kind::branch, operations.size() - 1, first + static_cast<std::uint32_t>(next.size()));
+
+					next.push_back(&b->l);
+					next.push_back(&b->r);
+				}
+				else
+				{
+					throw std::invalid_argument("only fully formed trees can be frozen");
+				}
+			}
+
+			level.swap(next);
+			next.clear();
+		}
+
+		levels.push_back(static_cast<std::uint32_t>(kinds.size()));
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param n The node to copy, typically a tree's root. Operations of branches are copied.
+	//!\throw std::invalid_argument If the tree has a node that was never assigned to.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	frozen_tree(const node<T, CachingPolicy, ThreadingPolicy>& n)
+	{
+		freeze(n, nullptr);
+	}
+
+	//!\brief Constructor.
+	//!
+	//!\param n The node to copy, typically a tree's root.
+	//!\param registry Where the operations of branches come from, rather than being copied, if they were registered there. It must outlive this tree.
+	//!\throw std::invalid_argument If the tree has a node that was never assigned to.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	frozen_tree(const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry)
+	{
+		freeze(n, &registry);
+	}
+
+	//!\brief The number of nodes.
+	std::size_t size() const
+	{
+		return kinds.size();
+	}
+
+	//!\brief The number of levels.
+	std::size_t depth() const
+	{
+		return levels.size() - 1;
+	}
+
+	//!\brief The first node of level \c d and the node past its last one. The root's level is 0.
+	std::pair<std::size_t, std::size_t> level(std::size_t d) const
+	{
+		return {levels[d], levels[d + 1]};
+	}
+
+	//!\brief The kind of node \c i.
+	kind kind_of(std::size_t i) const
+	{
+		return kinds[i];
+	}
+
+	//!\brief The left child of branch \c i. Its right child is the next node.
+	std::size_t left(std::size_t i) const
+	{
+		return children[i];
+	}
+
+	//!\brief Computes the value of nodes [\c begin, \c end), whose children's values are already in \c values.
+	void evaluate(std::size_t begin, std::size_t end, T *values) const
+	{
+		for(std::size_t i = begin; i != end; ++i)
+		{
+			switch(kinds[i])
+			{
+				case kind::constant:
+					values[i] = constants[data[i]];
+					break;
+
+				case kind::pointer:
+					values[i] = *pointers[data[i]];
+					break;
+
+				case kind::callable:
+					values[i] = callables[data[i]]();
+					break;
+
+				case kind::branch:
+				default:
+					values[i] = (*operations[data[i]])(values[children[i]], values[children[i] + 1]);
+					break;
+			}
+		}
+	}
+
+	//!\brief Evaluates this tree, level by level.
+	//!
+	//!\param values Receives the value of every node. Reusing it across evaluations saves its allocation.
+	//!\return The value of the root.
+	T evaluate(node_values<T>& values) const
+	{
+		values.resize(kinds.size());
+
+		for(std::size_t d = depth(); d-- != 0; )
+		{
+			evaluate(levels[d], levels[d + 1], values.data());
+		}
+
+		return values[0];
+	}
+
+	//!\brief Evaluates this tree, level by level.
+	T evaluate() const
+	{
+		node_values<T> values;
+
+		return evaluate(values);
+	}
+
+	//!\brief Evaluates this tree, level by level, splitting each level across threads.
+	//!
+	//! Threads claim chunks of a level's nodes and wait for each other before moving on to the next level.
+	//! No task is created per branch, which suits wide, shallow trees.
+	//! Levels narrower than a chunk are evaluated by a single thread.
+	//! Threads are taken from a pool that lives across evaluations. Concurrent and nested evaluations each get threads of their own; fewer are used only if threads can not be started.
+	//!
+	//!\param values Receives the value of every node. Reusing it across evaluations saves its allocation.
+	//!\param options Tuning.
+	//!\return The value of the root.
+	T evaluate(node_values<T>& values, const level_options& options) const
+	{
+		const std::size_t chunk = std::max<std::size_t>(options.chunk, 1);
+
+		std::size_t widest = 0;
+		for(std::size_t d = 0; d != depth(); ++d)
+		{
+			widest = std::max<std::size_t>(widest, levels[d + 1] - levels[d]);
+		}
+
+		// There is no point in having more threads than there are chunks in the widest level.
+		std::size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+		threads = std::min(threads, (widest + chunk - 1) / chunk);
+
+		detail::workers crew(threads);
+		if(crew.size() <= 1)
+		{
+			return evaluate(values);
+		}
+
+		values.resize(kinds.size());
+
+		std::unique_ptr<std::atomic<std::size_t>[]> claimed(new std::atomic<std::size_t>[depth()]);
+		for(std::size_t d = 0; d != depth(); ++d)
+		{
+			claimed[d] = 0;
+		}
+
+		detail::barrier b(crew.size());
+		std::mutex m;
+		std::exception_ptr error;
+		std::atomic<bool> failed(false);
+
+		auto work = [&]
+		{
+			for(std::size_t d = depth(); d-- != 0; )
+			{
+				const std::size_t begin = levels[d], end = levels[d + 1];
+
+				for(std::size_t i; !failed && (i = begin + claimed[d].fetch_add(chunk)) < end; )
+				{
+					try
+					{
+						evaluate(i, std::min(i + chunk, end), values.data());
+					}
+					catch(...)
+					{
+						std::lock_guard<std::mutex> lock(m);
+						if(!error) error = std::current_exception();
+						failed = true;
+					}
+				}
+
+				b.wait();
+			}
+		};
+
+		crew.run(work);
+
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+
+		return values[0];
+	}
+
+	//!\brief The memory used by this tree, broken down by kind of node.
+	//!
+	//! Kinds, payload and child indices are accounted for with the node they belong to.
+	memory_footprint memory_usage() const
+	{
+		memory_footprint m;
+		const std::size_t links = sizeof(kind) + 2 * sizeof(std::uint32_t);
+
+		m.constants = constants.size() * (links + sizeof(T));
+		m.pointers = pointers.size() * (links + sizeof(const T*));
+		m.callables = callables.size() * (links + sizeof(std::function<T ()>));
+		m.branches = operations.size() * (links + sizeof(const detail::operation<T>*)) + levels.size() * sizeof(std::uint32_t);
+		m.operations = unregistered.size() * (sizeof(std::unique_ptr<detail::operation<T>>) + sizeof(detail::operation<T>));
+
+		for(const auto& t : constants)
+		{
+			m.values += detail::heap_size<T>::of(t);
+		}
+
+		return m;
+	}
+};
+
+}
+
+#endif
+
+/*!
+\file expression_tree_frozen.h
+\brief Read-only trees laid out breadth-first as a structure of arrays.
+*/
@@ -0,0 +1,479 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+
+#if !defined(EXPRESSION_TREE_IMAGE_H)
+     #define EXPRESSION_TREE_IMAGE_H
+
+#include "expression_tree.h"
+#include "expression_tree_serialization.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace expression_tree
+{
+
+namespace detail
+{
+
+//!\brief Fixed-size header found at the start of a tree image.
+//!
+//! All offsets are relative to the start of the image, which makes an image relocatable.
+struct image_header
+{
+	char magic[4];					//!< Always "ETIM".
+	std::uint32_t version;			//!< Version of the layout.
+	std::uint32_t value_size;		//!< \c sizeof(T) of the tree the image was written from.
+	std::uint32_t operation_count;	//!< Number of operation names.
+	std::uint32_t node_count;		//!< Number of nodes. The root node is the first one.
+	std::uint32_t value_count;		//!< Number of constant leaf values.
+	std::uint32_t variable_count;	//!< Number of variables to provide at evaluation.
+	std::uint32_t reserved;			//!< Always zero.
+	std::uint64_t names_offset;		//!< Offset of the operation names, each a \c std::uint32_t length followed by characters.
+	std::uint64_t nodes_offset;		//!< Offset of the \c image_node array.
+	std::uint64_t values_offset;	//!< Offset of the \c T array.
+	std::uint64_t size;				//!< Size of the whole image.
+};
+
+//!\brief A node of a tree image.
+//!
+//! Nodes are laid out in preorder and refer to their children by index, so a branch's children always follow it.
+struct image_node
+{
+	static const std::uint32_t constant = 0xFFFFFFFF;	//!< Marks a leaf whose value is in the value array.
+	static const std::uint32_t variable = 0xFFFFFFFE;	//!< Marks a leaf whose value is provided at evaluation.
+
+	std::uint32_t operation;	//!< Index of a branch's operation name, or one of the leaf markers.
+	std::uint32_t left;			//!< Index of a branch's left child, or of a leaf's value or variable.
+	std::uint32_t right;		//!< Index of a branch's right child.
+};
+
+static const char image_magic[4] = {'E', 'T', 'I', 'M'};	//!< First bytes of a tree image.
+static const std::uint32_t image_version = 2;				//!< Version of the layout.
+
+//!\brief Rounds \c n up to a multiple of \c alignment.
+inline std::uint64_t align(std::uint64_t n, std::uint64_t alignment)
+{
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+//!\brief Appends a node and its children to an image's arrays in preorder.
+//!
+//! Nodes are visited with an explicit stack, so the depth of a tree is not limited by that of the call stack.
+//! A branch's left child is the node that follows it, its right child is found once its left subtree is written.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void image_nodes_of(const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry, const std::vector<const T*>& variables, std::vector<image_node>& nodes, std::vector<T>& values, std::vector<operation_id>& used, std::unordered_map<operation_id, std::uint32_t>& indices)
+{
+	static const std::uint32_t none = 0xFFFFFFFF;
+
+	// Nodes yet to write, each with the branch it is the right child of, if any.
+	std::vector<std::pair<const node<T, CachingPolicy, ThreadingPolicy>*, std::uint32_t>> pending{{&n, none}};
+
+	while(!pending.empty())
+	{
+		const auto& impl = access::impl(*pending.back().first);
+		const std::uint32_t parent = pending.back().second;
+		const std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+
+		pending.pop_back();
+
+		if(parent != none)
+		{
+			nodes[parent].right = index;
+		}
+
+		if(auto l = dynamic_cast<const leaf<T>*>(impl.get()))
+		{
+			nodes.push_back({image_node::constant, static_cast<std::uint32_t>(values.size()), 0});
+			values.push_back(l->data());
+		}
+		else if(auto p = dynamic_cast<const leaf<T*>*>(impl.get()))
+		{
+			auto v = std::find(variables.begin(), variables.end(), p->pointer());
+			if(v == variables.end())
+			{
+				throw serialization_error("pointer leaf is not a listed variable");
+			}
+
+			nodes.push_back({image_node::variable, static_cast<std::uint32_t>(v - variables.begin()), 0});
+		}
+		else if(auto b = dynamic_cast<const default_branch<T, CachingPolicy, ThreadingPolicy>*>(impl.get()))
+		{
+			if(!registry.contains(b->registered))
+			{
+				throw serialization_error("branch operation is not registered");
+			}
+
+			auto o = indices.emplace(b->id, static_cast<std::uint32_t>(used.size()));
+			if(o.second)
+			{
+				used.push_back(b->id);
+			}
+
+			nodes.push_back({o.first->second, index + 1, 0});
+
+			pending.push_back({&b->r, index});
+			pending.push_back({&b->l, none});
+		}
+		else
+		{
+			throw serialization_error("only constant leaves, listed variables and registered branches can be imaged");
+		}
+	}
+}
+
+}
+
+//!\brief Writes a tree image.
+//!
+//! A tree image is a relocatable, read-only layout of a tree that image_view evaluates in place.
+//! Children are referred to by index, leaves' values are stored in a plain array of \c T and operations by name.
+//! Values are stored in the machine's native byte order.
+//!
+//!\param os Where to write.
+//!\param n The node to write, typically a tree's root.
+//!\param registry The registry the node's operations come from.
+//!\param variables Pointers that leaves may hold. When the image is evaluated, the values of these variables are passed in the same order.
+//!\throw serialization_error If a branch's operation was not obtained from \c registry or if a leaf holds a callable or an unlisted pointer.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void write_image(std::ostream& os, const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry, const std::vector<const T*>& variables = {})
+{
+	static_assert(std::is_trivially_copyable<T>::value, "tree images require trivially copyable values");
+
+	std::vector<detail::image_node> nodes;
+	std::vector<T> values;
+	std::vector<operation_id> used;
+	std::unordered_map<operation_id, std::uint32_t> indices;
+
+	detail::image_nodes_of(n, registry, variables, nodes, values, used, indices);
+
+	std::string names;
+	for(auto id : used)
+	{
+		const std::string& name = registry[id].name;
+
+		value_serializer<std::uint32_t>::write(names, static_cast<std::uint32_t>(name.size()));
+		names += name;
+	}
+
+	detail::image_header header;
+	std::memcpy(header.magic, detail::image_magic, sizeof(header.magic));
+	header.version = detail::image_version;
+	header.value_size = sizeof(T);
+	header.operation_count = static_cast<std::uint32_t>(used.size());
+	header.node_count = static_cast<std::uint32_t>(nodes.size());
+	header.value_count = static_cast<std::uint32_t>(values.size());
+	header.variable_count = static_cast<std::uint32_t>(variables.size());
+	header.reserved = 0;
+	header.names_offset = sizeof(header);
+	header.nodes_offset = detail::align(header.names_offset + names.size(), alignof(detail::image_node));
+	header.values_offset = detail::align(header.nodes_offset + nodes.size() * sizeof(detail::image_node), alignof(T));
+	header.size = header.values_offset + values.size() * sizeof(T);
+
+	std::string image(static_cast<std::size_t>(header.size), '\0');
+	std::memcpy(&image[0], &header, sizeof(header));
+	std::memcpy(&image[header.names_offset], names.data(), names.size());
+	std::memcpy(&image[header.nodes_offset], nodes.data(), nodes.size() * sizeof(detail::image_node));
+	std::memcpy(&image[header.values_offset], values.data(), values.size() * sizeof(T));
+
+	os.write(image.data(), image.size());
+}
+
+//!\brief Evaluates a tree image in place.
+//!
+//! Only operations are resolved when a view is created. Nodes and values are read directly from the image.
+//! Many views, in as many processes, can thus share a single copy of an image.
+template<typename T>
+class image_view
+{
+	const detail::image_node *nodes;				//!< The image's nodes.
+	const T *values;								//!< The image's constant values.
+	std::vector<const detail::operation<T>*> operations;	//!< Operations indexed as in the image.
+	std::uint32_t variable_count;					//!< Number of variables to provide at evaluation.
+	std::uint32_t node_count;						//!< Number of nodes.
+
+	//!\brief Evaluates the root.
+	//!
+	//! Nodes are swept from the last to the first, without recursion. Because they are in preorder, when a branch is reached
+	//! the values of both its subtrees are on top of the stack, its left child's above its right child's.
+	T evaluate_nodes(const T *variables) const
+	{
+		std::vector<T> stack;
+
+		for(std::uint32_t i = node_count; i-- != 0; )
+		{
+			const detail::image_node& n = nodes[i];
+
+			switch(n.operation)
+			{
+				case detail::image_node::constant:
+					stack.push_back(values[n.left]);
+					break;
+
+				case detail::image_node::variable:
+					stack.push_back(variables[n.left]);
+					break;
+
+				default:
+				{
+					T l = std::move(stack.back());
+					stack.pop_back();
+
+					stack.back() = (*operations[n.operation])(l, stack.back());
+				}
+			}
+		}
+
+		return stack.back();
+	}
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param data The image. It must be aligned at least as strictly as \c T and outlive this view.
+	//!\param size The size of the image.
+	//!\param registry The registry to look operations up in. It must outlive this view.
+	//!\throw serialization_error If the data is not a valid image for \c T or if an operation is not found in \c registry.
+	//! The whole image is checked here, so that evaluation never reads outside of it.
+	image_view(const void *data, std::size_t size, const operation_registry<T>& registry)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "tree images require trivially copyable values");
+
+		const char *begin = static_cast<const char*>(data);
+		detail::image_header header;
+
+		if(size < sizeof(header) || reinterpret_cast<std::uintptr_t>(data) % std::max(alignof(T), alignof(detail::image_node)))
+		{
+			throw serialization_error("not a tree image");
+		}
+
+		std::memcpy(&header, begin, sizeof(header));
+		if(std::memcmp(header.magic, detail::image_magic, sizeof(header.magic)) != 0 || header.version != detail::image_version || header.value_size != sizeof(T) || header.size > size || header.node_count == 0)
+		{
+			throw serialization_error("not a tree image");
+		}
+
+		// Each section must lie within the image and be aligned for what it holds.
+		if(header.names_offset < sizeof(header) || header.names_offset > header.nodes_offset || header.nodes_offset > header.size || header.nodes_offset % alignof(detail::image_node)
+			|| header.node_count > (header.size - header.nodes_offset) / sizeof(detail::image_node)
+			|| header.values_offset > header.size || header.values_offset % alignof(T)
+			|| header.value_count > (header.size - header.values_offset) / sizeof(T))
+		{
+			throw serialization_error("tree image sections are out of bounds");
+		}
+
+		byte_reader names(begin + header.names_offset, begin + header.nodes_offset);
+		for(std::uint32_t i = 0; i != header.operation_count; ++i)
+		{
+			std::string name(names.get<std::uint32_t>(), '\0');
+			names.copy(&name[0], name.size());
+
+			auto o = registry.find(name);
+			if(!o)
+			{
+				throw serialization_error("operation \"" + name + "\" is not registered");
+			}
+
+			operations.push_back(&o->f);
+		}
+
+		nodes = reinterpret_cast<const detail::image_node*>(begin + header.nodes_offset);
+		values = reinterpret_cast<const T*>(begin + header.values_offset);
+		variable_count = header.variable_count;
+		node_count = header.node_count;
+
+		// Nodes must form a single tree in preorder: a branch's left child follows it and its right child follows its left subtree.
+		// This rules out cycles and shared or stray nodes, which evaluation relies on.
+		std::vector<std::uint32_t> sizes(node_count);
+		for(std::uint32_t i = node_count; i-- != 0; )
+		{
+			const detail::image_node& n = nodes[i];
+
+			bool valid;
+			switch(n.operation)
+			{
+				case detail::image_node::constant:
+					valid = n.left < header.value_count;
+					break;
+
+				case detail::image_node::variable:
+					valid = n.left < header.variable_count;
+					break;
+
+				default:
+					valid = n.operation < header.operation_count && n.left == i + 1 && n.left < node_count && n.right == n.left + sizes[n.left] && n.right < node_count;
+			}
+
+			if(!valid)
+			{
+				throw serialization_error("tree image node " + std::to_string(i) + " is invalid");
+			}
+
+			sizes[i] = n.operation < header.operation_count ? 1 + sizes[n.left] + sizes[n.right] : 1;
+		}
+
+		if(sizes[0] != node_count)
+		{
+			throw serialization_error("tree image nodes do not form a single tree");
+		}
+	}
+
+	//!\brief Evaluates the image.
+	//!
+	//!\param variables The values of the variables listed when the image was written, in the same order.
+	//!\throw std::invalid_argument If \c variables is null while the image has variables.
+	T evaluate(const T *variables = nullptr) const
+	{
+		if(!variables && variable_count)
+		{
+			throw std::invalid_argument("tree image needs " + std::to_string(variable_count) + " variables");
+		}
+
+		return evaluate_nodes(variables);
+	}
+
+	//!\brief Evaluates the image.
+	//!
+	//!\param variables The values of the variables listed when the image was written, in the same order.
+	//!\param count The number of values \c variables points to.
+	//!\throw std::invalid_argument If \c count is less than the number of variables the image has.
+	T evaluate(const T *variables, std::size_t count) const
+	{
+		if(count < variable_count)
+		{
+			throw std::invalid_argument("tree image needs " + std::to_string(variable_count) + " variables, got " + std::to_string(count));
+		}
+
+		return evaluate_nodes(variables);
+	}
+
+	//!\brief The number of variables to provide at evaluation.
+	std::size_t variables() const
+	{
+		return variable_count;
+	}
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+
+//!\brief A tree image mapped read-only from a file.
+//!
+//! The file's pages are shared through the page cache by all processes that map it.
+template<typename T>
+class mapped_image
+{
+	//!\brief Owns a read-only mapping of a file.
+	struct mapping
+	{
+		void *data;			//!< The mapping.
+		std::size_t size;	//!< The size of the mapping.
+
+		//!\brief Maps a file.
+		mapping(const std::string& path)
+		{
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if(fd == -1)
+			{
+				throw serialization_error("cannot open " + path);
+			}
+
+			struct stat s;
+			data = ::fstat(fd, &s) == 0 ? ::mmap(nullptr, static_cast<std::size_t>(s.st_size), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+			size = static_cast<std::size_t>(s.st_size);
+			::close(fd);
+
+			if(data == MAP_FAILED)
+			{
+				throw serialization_error("cannot map " + path);
+			}
+		}
+
+		mapping(const mapping&) = delete;
+		mapping& operator=(const mapping&) = delete;
+
+		~mapping()
+		{
+			::munmap(data, size);
+		}
+	};
+
+	mapping file;			//!< The mapped file.
+	image_view<T> view;		//!< View on the mapped file.
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param path The file holding the image.
+	//!\param registry The registry to look operations up in. It must outlive this object.
+	mapped_image(const std::string& path, const operation_registry<T>& registry) : file(path), view(file.data, file.size, registry) {}
+
+	//!\brief Evaluates the image.
+	//!
+	//!\param variables The values of the variables listed when the image was written, in the same order.
+	//!\throw std::invalid_argument If \c variables is null while the image has variables.
+	T evaluate(const T *variables = nullptr) const
+	{
+		return view.evaluate(variables);
+	}
+
+	//!\brief Evaluates the image.
+	//!
+	//!\param variables The values of the variables listed when the image was written, in the same order.
+	//!\param count The number of values \c variables points to.
+	//!\throw std::invalid_argument If \c count is less than the number of variables the image has.
+	T evaluate(const T *variables, std::size_t count) const
+	{
+		return view.evaluate(variables, count);
+	}
+};
+
+#endif
+
+}
+
+#endif
+
+/*!
+\file expression_tree_image.h
+\brief Relocatable tree images that are evaluated in place, typically from a memory-mapped file.
+*/
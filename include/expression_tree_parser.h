@@ -0,0 +1,416 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+
+#if !defined(EXPRESSION_TREE_PARSER_H)
+     #define EXPRESSION_TREE_PARSER_H
+
+#include "expression_tree.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief Thrown when an expression cannot be parsed.
+class parse_error : public std::runtime_error
+{
+public:
+	std::size_t position;	//!< Offset in the expression where the error was found.
+
+	//!\brief Constructor.
+	parse_error(const std::string& what, std::size_t position) : std::runtime_error(what + " at offset " + std::to_string(position)), position(position) {}
+};
+
+//!\brief Parses literal values.
+//!
+//! This default implementation parses no literal at all.
+//! Specialize this class to parse literals of other types.
+template<typename T, typename = void>
+struct literal
+{
+	//!\brief Parses a literal starting at \c p.
+	//!
+	//!\param p Where to start parsing. On success, it is moved past the literal.
+	//!\param t Receives the literal's value.
+	//!\return Whether a literal was parsed.
+	static bool parse(const char*&, T&)
+	{
+		return false;
+	}
+};
+
+//!\brief Parses numbers.
+template<typename T>
+struct literal<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+	//!\brief Parses a number starting at \c p.
+	static bool parse(const char*& p, T& t)
+	{
+		if(!std::isdigit(static_cast<unsigned char>(*p)) && *p != '.' && *p != '-' && *p != '+')
+		{
+			return false;
+		}
+
+		char *end;
+		if(std::is_integral<T>::value)
+		{
+			t = static_cast<T>(std::strtoll(p, &end, 10));
+		}
+		else
+		{
+			t = static_cast<T>(std::strtod(p, &end));
+		}
+
+		if(end == p)
+		{
+			return false;
+		}
+
+		p = end;
+
+		return true;
+	}
+};
+
+//!\brief Parses double-quoted strings in which a backslash escapes the next character.
+template<typename C, typename Traits, typename Allocator>
+struct literal<std::basic_string<C, Traits, Allocator>>
+{
+	//!\brief Parses a string starting at \c p.
+	static bool parse(const char*& p, std::basic_string<C, Traits, Allocator>& t)
+	{
+		if(*p != '"')
+		{
+			return false;
+		}
+
+		const char *q = p + 1;
+
+		t.clear();
+		for(; *q && *q != '"'; ++q)
+		{
+			if(*q == '\\' && *(q + 1))
+			{
+				++q;
+			}
+
+			t.push_back(static_cast<C>(*q));
+		}
+
+		if(!*q)
+		{
+			return false;
+		}
+
+		p = q + 1;
+
+		return true;
+	}
+};
+
+//!\brief Describes the expressions that parse understands.
+//!
+//! An expression is made of:
+//! - literals, as parsed by literal,
+//! - variables, bound to a name with variable,
+//! - binary operators, bound to a symbol with binary,
+//! - calls of the form <tt>name(a, b)</tt> where \c name is that of a registered operation,
+//! - parentheses.
+template<typename T>
+class grammar
+{
+public:
+	//!\brief A binary operator.
+	struct binary_operator
+	{
+		std::string symbol;							//!< The operator's symbol.
+		const registered_operation<T> *operation;	//!< The operation it performs.
+		int precedence;								//!< Operators of higher precedence bind tighter.
+		bool right_associative;						//!< Whether <tt>a op b op c</tt> means <tt>a op (b op c)</tt>.
+	};
+
+	const operation_registry<T>& registry;	//!< Where operations come from.
+
+	std::vector<binary_operator> operators;					//!< Binary operators, longest symbols first.
+	std::unordered_map<std::string, const T*> variables;	//!< Variables by name.
+
+	//!\brief Constructor.
+	//!
+	//!\param registry Where operations come from. It must outlive this grammar.
+	grammar(const operation_registry<T>& registry) : registry(registry) {}
+
+	//!\brief Binds a symbol to a registered operation.
+	//!
+	//!\param symbol The operator's symbol, e.g. "+".
+	//!\param operation The name of a registered operation.
+	//!\param precedence Operators of higher precedence bind tighter.
+	//!\param right_associative Whether <tt>a op b op c</tt> means <tt>a op (b op c)</tt>.
+	//!\throw std::invalid_argument If \c operation is not registered.
+	grammar& binary(const std::string& symbol, const std::string& operation, int precedence, bool right_associative = false)
+	{
+		auto o = registry.find(operation);
+		if(!o)
+		{
+			throw std::invalid_argument("operation \"" + operation + "\" is not registered");
+		}
+
+		binary_operator b{symbol, o, precedence, right_associative};
+		operators.insert(std::find_if(operators.begin(), operators.end(), [&](const binary_operator& c){ return c.symbol.size() < symbol.size(); }), b);
+
+		return *this;
+	}
+
+	//!\brief Binds a name to a variable.
+	grammar& variable(const std::string& name, const T* p)
+	{
+		variables[name] = p;
+
+		return *this;
+	}
+};
+
+namespace detail
+{
+
+//!\brief Precedence-climbing parser that builds node implementations directly.
+//!
+//! Each branch is built once both its children are, so no modification is ever propagated up the tree.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class parser
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;	//!< Convenience alias.
+	using branch_t = typename CachingPolicy<T, ThreadingPolicy>::branch;	//!< Convenience alias.
+	using impl_t = std::unique_ptr<node_impl<T>>;	//!< Convenience alias.
+
+	const grammar<T>& g;	//!< What to parse.
+	const char *begin;		//!< Start of the expression.
+	const char *p;			//!< Current position.
+
+	//!\brief Throws a parse_error at the current position.
+	[[noreturn]] void fail(const std::string& what) const
+	{
+		throw parse_error(what, p - begin);
+	}
+
+	//!\brief Skips whitespace.
+	void skip()
+	{
+		while(std::isspace(static_cast<unsigned char>(*p))) ++p;
+	}
+
+	//!\brief Skips whitespace and tells whether \c c is next.
+	bool next(char c)
+	{
+		skip();
+
+		return *p == c;
+	}
+
+	//!\brief Builds a branch out of its two children.
+	impl_t branch(const registered_operation<T>& o, impl_t l, impl_t r)
+	{
+		auto b = std::make_unique<branch_t>(o.f, node_t(), node_t());
+		b->id = o.id;
+		b->registered = &o;
+
+		access::impl(b->left()) = std::move(l);
+		access::impl(b->right()) = std::move(r);
+		access::adopt(b->left());
+		access::adopt(b->right());
+
+		b->modified();
+
+		return impl_t(std::move(b));
+	}
+
+	//!\brief Parses a literal, a variable, a call or a parenthesized expression.
+	impl_t primary()
+	{
+		if(next('('))
+		{
+			++p;
+			impl_t e = expression(0);
+			if(!next(')'))
+			{
+				fail("expected ')'");
+			}
+			++p;
+
+			return e;
+		}
+
+		T t;
+		if(literal<T>::parse(p, t))
+		{
+			return std::make_unique<leaf<T>>(t);
+		}
+
+		if(!std::isalpha(static_cast<unsigned char>(*p)) && *p != '_')
+		{
+			fail("expected an operand");
+		}
+
+		const char *name = p;
+		while(std::isalnum(static_cast<unsigned char>(*p)) || *p == '_') ++p;
+		std::string identifier(name, p);
+
+		if(next('('))
+		{
+			auto o = g.registry.find(identifier);
+			if(!o)
+			{
+				p = name;
+				fail("unknown operation \"" + identifier + "\"");
+			}
+
+			++p;
+			impl_t l = expression(0);
+			if(!next(','))
+			{
+				fail("expected ','");
+			}
+			++p;
+			impl_t r = expression(0);
+			if(!next(')'))
+			{
+				fail("expected ')'");
+			}
+			++p;
+
+			return branch(*o, std::move(l), std::move(r));
+		}
+
+		auto v = g.variables.find(identifier);
+		if(v == g.variables.end())
+		{
+			p = name;
+			fail("unknown variable \"" + identifier + "\"");
+		}
+
+		return std::make_unique<leaf<T*>>(v->second);
+	}
+
+	//!\brief The binary operator at the current position, if any.
+	const typename grammar<T>::binary_operator* binary()
+	{
+		skip();
+
+		for(const auto& o : g.operators)
+		{
+			if(std::strncmp(p, o.symbol.c_str(), o.symbol.size()) == 0)
+			{
+				return &o;
+			}
+		}
+
+		return nullptr;
+	}
+
+public:
+	//!\brief Constructor.
+	parser(const grammar<T>& g, const char *expression) : g(g), begin(expression), p(expression) {}
+
+	//!\brief Parses an expression whose operators all have a precedence of at least \c precedence.
+	impl_t expression(int precedence)
+	{
+		impl_t l = primary();
+
+		while(auto o = binary())
+		{
+			if(o->precedence < precedence)
+			{
+				break;
+			}
+
+			p += o->symbol.size();
+			impl_t r = expression(o->right_associative ? o->precedence : o->precedence + 1);
+			l = branch(*o->operation, std::move(l), std::move(r));
+		}
+
+		return l;
+	}
+
+	//!\brief Whether the whole expression was consumed.
+	bool done()
+	{
+		return next('\0');
+	}
+
+	//!\brief Throws a parse_error at the current position.
+	void unexpected() const
+	{
+		fail("unexpected character");
+	}
+};
+
+}
+
+//!\brief Parses an expression and assigns it to a node.
+//!
+//! Nodes are built directly, in a single pass over the expression, rather than through successive assignments.
+//! Branches remember the identifier of their registered operation, so a parsed tree can be saved.
+//!
+//!\param expression The expression to parse, e.g. <tt>"2 * a + (b - 3)"</tt>.
+//!\param n The node to assign to, typically a tree's root.
+//!\param g The operators, variables and operations \c expression may use.
+//!\throw parse_error If \c expression is malformed. In that case, \c n is left unmodified.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void parse(const std::string& expression, node<T, CachingPolicy, ThreadingPolicy>& n, const grammar<T>& g)
+{
+	detail::parser<T, CachingPolicy, ThreadingPolicy> p(g, expression.c_str());
+
+	auto impl = p.expression(0);
+	if(!p.done())
+	{
+		p.unexpected();
+	}
+
+	detail::access::impl(n) = std::move(impl);
+	detail::access::adopt(n);
+
+	detail::access::notify(n);
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_parser.h
+\brief Parsing of infix expressions into trees.
+*/
@@ -0,0 +1,390 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_POOL_H)
+     #define EXPRESSION_TREE_POOL_H
+
+#include "expression_tree.h"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief A tree whose nodes are stored in contiguous arrays and link to each other with 32-bit indices.
+//!
+//! Nodes are created bottom-up: a branch is created out of existing nodes, which become its children.
+//! Every node is thus stored after its children, and a tree copied from a node is stored in postorder,
+//! which makes evaluation walk memory mostly forward.
+//! Each node costs 17 bytes plus its value, pointer, callable or operation.
+template<typename T>
+class pool_tree
+{
+public:
+	//!\brief Identifies a node within its pool.
+	using index = std::uint32_t;
+
+	//!\brief Index that identifies no node.
+	static constexpr index none = std::numeric_limits<index>::max();
+
+	//!\brief Kinds of nodes.
+	enum class kind : std::uint8_t
+	{
+		constant,	//!< A leaf with a constant value.
+		pointer,	//!< A leaf pointing to a variable.
+		callable,	//!< A leaf holding a callable.
+		branch		//!< A branch.
+	};
+
+	//!\brief The links of a node.
+	struct slot
+	{
+		index parent;	//!< This node's parent, or \c none.
+		index left;		//!< A branch's left child.
+		index right;	//!< A branch's right child.
+		index data;		//!< Index of this node's value, pointer, callable or operation.
+	};
+
+private:
+	const operation_registry<T> *registry;	//!< Where shared operations come from, if anywhere.
+
+	std::vector<slot> slots;			//!< The links of each node.
+	std::vector<kind> kinds;			//!< The kind of each node.
+	index root_ = none;					//!< The node evaluate starts from.
+
+	std::vector<T> constants;							//!< Values of constant leaves.
+	std::vector<const T*> pointers;						//!< Pointers of pointer leaves.
+	std::vector<std::function<T ()>> callables;			//!< Callables of callable leaves.
+	std::vector<const detail::operation<T>*> operations;	//!< Operations of branches.
+	std::vector<std::unique_ptr<detail::operation<T>>> unregistered;	//!< Copies of operations that were not registered.
+
+	//!\brief Appends a node and returns its index.
+	index push(kind k, std::size_t data, index left = none, index right = none)
+	{
+		if(slots.size() >= none || data >= none)
+		{
+			throw std::length_error("a pool_tree can hold at most 2^32 - 1 nodes");
+		}
+
+		slots.push_back({none, left, right, static_cast<index>(data)});
+		kinds.push_back(k);
+
+		return root_ = static_cast<index>(slots.size() - 1);
+	}
+
+	//!\brief Makes sure \c l and \c r can become the children of a new branch.
+	void check(index l, index r) const
+	{
+		if(l == r || l >= slots.size() || r >= slots.size() || slots[l].parent != none || slots[r].parent != none)
+		{
+			throw std::invalid_argument("a node can only become the child of a single, new branch");
+		}
+	}
+
+	//!\brief Creates a branch out of existing nodes, which were checked.
+	index branch(const detail::operation<T> *f, index l, index r)
+	{
+		operations.push_back(f);
+
+		index b = push(kind::branch, operations.size() - 1, l, r);
+		slots[l].parent = b;
+		slots[r].parent = b;
+
+		return b;
+	}
+
+public:
+	//!\brief Constructor.
+	pool_tree() : registry(nullptr) {}
+
+	//!\brief Constructor.
+	//!
+	//!\param registry Where the operations of branches copied by add come from, rather than being copied. It must outlive this pool.
+	pool_tree(const operation_registry<T>& registry) : registry(&registry) {}
+
+	//!\brief Reserves room for \c n nodes.
+	void reserve(std::size_t n)
+	{
+		slots.reserve(n);
+		kinds.reserve(n);
+	}
+
+	//!\brief Creates a leaf with a constant value.
+	//!
+	//! Like all other node creation functions, it makes the new node the root.
+	index constant(const T& t)
+	{
+		constants.push_back(t);
+
+		return push(kind::constant, constants.size() - 1);
+	}
+
+	//!\brief Creates a leaf that points to a variable.
+	index pointer(const T* p)
+	{
+		pointers.push_back(p);
+
+		return push(kind::pointer, pointers.size() - 1);
+	}
+
+	//!\brief Creates a leaf that holds a callable.
+	index callable(const std::function<T ()>& f)
+	{
+		callables.push_back(f);
+
+		return push(kind::callable, callables.size() - 1);
+	}
+
+	//!\brief Creates a branch out of existing nodes, which become its children.
+	//!
+	//!\param o The branch's operation. It must outlive this pool.
+	//!\param l The left child.
+	//!\param r The right child.
+	//!\throw std::invalid_argument If a child already has a parent or if \c l and \c r are the same node.
+	index branch(const registered_operation<T>& o, index l, index r)
+	{
+		check(l, r);
+
+		return branch(&o.f, l, r);
+	}
+
+	//!\brief Creates a branch out of existing nodes with an operation that was not registered.
+	//!
+	//! The pool keeps a copy of the operation.
+	index branch(const detail::operation<T>& f, index l, index r)
+	{
+		check(l, r);
+
+		unregistered.push_back(std::make_unique<detail::operation<T>>(f));
+
+		return branch(unregistered.back().get(), l, r);
+	}
+
+	//!\brief Copies a node and its children into this pool.
+	//!
+	//! Nodes are stored in postorder. They are visited with an explicit stack, so the depth of a tree is not limited by that of the call stack.
+	//! Operations of branches are shared with this pool's registry if they were obtained from it, and copied otherwise.
+	//!
+	//!\return The index of the copy of \c n, which becomes the root.
+	//!\throw std::invalid_argument If the tree has a node that was never assigned to.
+	template<template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+	index add(const node<T, CachingPolicy, ThreadingPolicy>& n)
+	{
+		using branch_t = detail::default_branch<T, CachingPolicy, ThreadingPolicy>;
+
+		// Nodes yet to copy. A branch is stacked a second time, as null, below its children and is created once they are.
+		std::vector<std::pair<const node<T, CachingPolicy, ThreadingPolicy>*, const branch_t*>> pending{{&n, nullptr}};
+		std::vector<index> copies;
+
+		while(!pending.empty())
+		{
+			auto top = pending.back();
+			pending.pop_back();
+
+			if(const branch_t *b = top.second)
+			{
+				index r = copies.back();
+				copies.pop_back();
+
+				if(registry && registry->contains(b->registered))
+				{
+					copies.back() = branch(*b->registered, copies.back(), r);
+				}
+				else
+				{
+					copies.back() = branch(b->f, copies.back(), r);
+				}
+
+				continue;
+			}
+
+			const auto& impl = detail::access::impl(*top.first);
+
+			if(auto l = dynamic_cast<const detail::leaf<T>*>(impl.get()))
+			{
+				copies.push_back(constant(l->data()));
+			}
+			else if(auto p = dynamic_cast<const detail::leaf<T*>*>(impl.get()))
+			{
+				copies.push_back(pointer(p->pointer()));
+			}
+			else if(auto c = dynamic_cast<const detail::leaf<T (*)()>*>(impl.get()))
+			{
+				copies.push_back(callable(c->callable()));
+			}
+			else if(auto b = dynamic_cast<const branch_t*>(impl.get()))
+			{
+				pending.push_back({nullptr, b});
+				pending.push_back({&b->r, nullptr});
+				pending.push_back({&b->l, nullptr});
+			}
+			else
+			{
+				throw std::invalid_argument("only fully formed trees can be added to a pool_tree");
+			}
+		}
+
+		return copies.back();
+	}
+
+	//!\brief Makes node \c i the one evaluate starts from.
+	void root(index i)
+	{
+		root_ = i;
+	}
+
+	//!\brief The node evaluate starts from, by default the last one created.
+	index root() const
+	{
+		return root_;
+	}
+
+	//!\brief Assigns a new value to a constant leaf.
+	//!
+	//! Note that if node \c i is not a constant leaf, behavior is undefined.
+	void assign(index i, const T& t)
+	{
+		constants[slots[i].data] = t;
+	}
+
+	//!\brief The kind of node \c i.
+	kind kind_of(index i) const
+	{
+		return kinds[i];
+	}
+
+	//!\brief The links of node \c i.
+	const slot& links(index i) const
+	{
+		return slots[i];
+	}
+
+	//!\brief The number of nodes.
+	std::size_t size() const
+	{
+		return slots.size();
+	}
+
+	//!\brief Evaluates node \c i.
+	//!
+	//! Like the sequential threading policy, a branch evaluates its right child before its left child.
+	//! Nodes are visited with an explicit stack, so the depth of a tree is not limited by that of the call stack.
+	T evaluate(index i) const
+	{
+		// Nodes yet to evaluate. A branch is stacked a second time, flagged, below its children and is evaluated once they are.
+		std::vector<std::pair<index, bool>> pending{{i, false}};
+		std::vector<T> values;
+
+		while(!pending.empty())
+		{
+			auto top = pending.back();
+			pending.pop_back();
+
+			const slot& s = slots[top.first];
+
+			if(top.second)
+			{
+				T l = std::move(values.back());
+				values.pop_back();
+
+				values.back() = (*operations[s.data])(l, values.back());
+
+				continue;
+			}
+
+			switch(kinds[top.first])
+			{
+				case kind::constant:
+					values.push_back(constants[s.data]);
+					break;
+
+				case kind::pointer:
+					values.push_back(*pointers[s.data]);
+					break;
+
+				case kind::callable:
+					values.push_back(callables[s.data]());
+					break;
+
+				case kind::branch:
+				default:
+					pending.push_back({top.first, true});
+					pending.push_back({s.left, false});
+					pending.push_back({s.right, false});
+			}
+		}
+
+		return values.back();
+	}
+
+	//!\brief Evaluates the root.
+	T evaluate() const
+	{
+		return evaluate(root_);
+	}
+
+	//!\brief The memory used by this pool, broken down by kind of node.
+	//!
+	//! Links are accounted for with the node they belong to. Storage reserved but not used is not accounted for.
+	memory_footprint memory_usage() const
+	{
+		memory_footprint m;
+		const std::size_t links = sizeof(slot) + sizeof(kind);
+
+		m.constants = constants.size() * (links + sizeof(T));
+		m.pointers = pointers.size() * (links + sizeof(const T*));
+		m.callables = callables.size() * (links + sizeof(std::function<T ()>));
+		m.branches = operations.size() * (links + sizeof(const detail::operation<T>*));
+		m.operations = unregistered.size() * (sizeof(std::unique_ptr<detail::operation<T>>) + sizeof(detail::operation<T>));
+
+		for(const auto& t : constants)
+		{
+			m.values += detail::heap_size<T>::of(t);
+		}
+
+		return m;
+	}
+};
+
+template<typename T>
+constexpr typename pool_tree<T>::index pool_tree<T>::none;
+
+}
+
+#endif
+
+/*!
+\file expression_tree_pool.h
+\brief Trees stored in contiguous arrays with 32-bit links.
+*/
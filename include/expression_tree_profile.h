@@ -0,0 +1,313 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+
+#if !defined(EXPRESSION_TREE_PROFILE_H)
+     #define EXPRESSION_TREE_PROFILE_H
+
+#include "expression_tree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief Measurements of a single branch.
+struct branch_profile
+{
+	std::uint64_t evaluations = 0;	//!< Number of times the branch applied its operation, i.e. cache misses for caching branches.
+	std::uint64_t hits = 0;			//!< Number of times the branch returned its cached value.
+	std::chrono::nanoseconds inclusive = std::chrono::nanoseconds(0);	//!< Time spent applying the operation, children included.
+};
+
+//!\brief Collects the measurements made by trees instantiated with the profiled threading policy.
+//!
+//! Measurements are made while a profile is started and are keyed by branch.
+//! A tree must not be modified between the time it is profiled and the time it is reported on.
+class profile
+{
+	std::mutex m;	//!< Guards branches.
+	std::unordered_map<const void*, branch_profile> branches;	//!< Measurements keyed by the address of each branch's left child.
+
+	//!\brief Ranked report entry.
+	struct entry
+	{
+		std::string path;		//!< Position of the branch in the tree.
+		std::string name;		//!< Name of the branch's operation.
+		branch_profile p;		//!< Measurements.
+		std::chrono::nanoseconds exclusive;	//!< Time spent applying the operation, children excluded.
+	};
+
+	//!\brief Walks a tree and computes the exclusive time of each of its branches.
+	//!
+	//! Branches are visited with an explicit stack, and the path and frames of the current branch are grown and shrunk in place,
+	//! so the cost of a walk is linear in the size of the tree and its depth is not limited by that of the call stack.
+	//!
+	//!\param visit Called with the path, operation name, frames, measurements and exclusive time of every branch, children before parents.
+	//!\return The inclusive time of \c n.
+	template<typename T, template<typename, typename> class C, class E, typename F>
+	std::chrono::nanoseconds walk(const node<T, C, E>& n, const operation_registry<T> *registry, F& visit) const
+	{
+		using branch_t = detail::default_branch<T, C, E>;
+
+		//!\brief A branch whose children are being walked.
+		struct step
+		{
+			const branch_t *b;
+			std::string name;
+			branch_profile p;
+			int walked;								//!< Number of its children walked so far.
+			std::chrono::nanoseconds children;		//!< Inclusive time of its children.
+		};
+
+		std::string path = "root";
+		std::vector<std::string> frames;
+		std::vector<step> steps;
+
+		// Starts walking a node whose path is in path. Leaves have nothing to walk.
+		auto enter = [&](const node<T, C, E>& child)
+		{
+			auto b = dynamic_cast<const branch_t*>(detail::access::impl(child).get());
+			if(!b) return false;
+
+			branch_profile p;
+			auto i = branches.find(&b->l);
+			if(i != branches.end()) p = i->second;
+
+			std::string name = registry && registry->contains(b->registered) ? b->registered->name : std::string("branch");
+
+			frames.push_back(frames.empty() ? name : name + (path.back() == 'l' ? "[l]" : "[r]"));
+			steps.push_back({b, std::move(name), p, 0, std::chrono::nanoseconds(0)});
+
+			return true;
+		};
+
+		if(!enter(n)) return std::chrono::nanoseconds(0);
+
+		while(true)
+		{
+			step& s = steps.back();
+
+			if(s.walked != 2)
+			{
+				path += s.walked++ ? ".r" : ".l";
+				if(!enter(s.walked == 1 ? s.b->l : s.b->r))
+				{
+					path.resize(path.size() - 2);
+				}
+
+				continue;
+			}
+
+			visit(path, s.name, frames, s.p, std::max(s.p.inclusive - s.children, std::chrono::nanoseconds(0)));
+
+			const std::chrono::nanoseconds inclusive = s.p.inclusive;
+			steps.pop_back();
+			frames.pop_back();
+
+			if(steps.empty()) return inclusive;
+
+			steps.back().children += inclusive;
+			path.resize(path.size() - 2);
+		}
+	}
+
+	//!\brief The currently started profile.
+	static std::atomic<profile*>& active()
+	{
+		static std::atomic<profile*> a(nullptr);
+
+		return a;
+	}
+
+public:
+	//!\brief Stops this profile if it is started.
+	~profile()
+	{
+		stop();
+	}
+
+	//!\brief The currently started profile, if any.
+	static profile* current()
+	{
+		return active().load(std::memory_order_relaxed);
+	}
+
+	//!\brief Makes this profile the one measurements are recorded in.
+	void start()
+	{
+		active().store(this);
+	}
+
+	//!\brief Stops recording measurements, if this profile was started.
+	void stop()
+	{
+		profile *self = this;
+		active().compare_exchange_strong(self, nullptr);
+	}
+
+	//!\brief Forgets all measurements.
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		branches.clear();
+	}
+
+	//!\brief Records an evaluation of the branch whose left child is at \c key.
+	void evaluated(const void *key, std::chrono::nanoseconds duration)
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		auto& p = branches[key];
+		++p.evaluations;
+		p.inclusive += duration;
+	}
+
+	//!\brief Records a cache hit of the branch whose left child is at \c key.
+	void hit(const void *key)
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		++branches[key].hits;
+	}
+
+	//!\brief Writes a report of a tree's branches, ranked by decreasing exclusive time.
+	//!
+	//! Each line shows a branch's path from the root, its operation's name, its number of evaluations and cache hits,
+	//! and its inclusive and exclusive times in nanoseconds.
+	//!
+	//!\param os Where to write.
+	//!\param n The node to report on, typically a tree's root.
+	//!\param registry If given, used to name branches after their registered operation.
+	template<typename T, template<typename, typename> class C, class E>
+	void report(std::ostream& os, const node<T, C, E>& n, const operation_registry<T> *registry = nullptr) const
+	{
+		std::vector<entry> entries;
+		auto visit = [&entries](const std::string& path, const std::string& name, const std::vector<std::string>&, const branch_profile& p, std::chrono::nanoseconds exclusive)
+		{
+			entries.push_back({path, name, p, exclusive});
+		};
+
+		walk(n, registry, visit);
+
+		std::stable_sort(entries.begin(), entries.end(), [](const entry& a, const entry& b){ return a.exclusive > b.exclusive; });
+
+		os << "path\toperation\tevaluations\thits\tinclusive_ns\texclusive_ns\n";
+		for(const auto& e : entries)
+		{
+			os << e.path << '\t' << e.name << '\t' << e.p.evaluations << '\t' << e.p.hits << '\t' << e.p.inclusive.count() << '\t' << e.exclusive.count() << '\n';
+		}
+	}
+
+	//!\brief Writes the exclusive time of a tree's branches as collapsed stacks.
+	//!
+	//! Each line is made of semicolon-separated frames, from the root to a branch, followed by that branch's exclusive time in nanoseconds.
+	//! This is the input format of flame graph tools.
+	//!
+	//!\param os Where to write.
+	//!\param n The node to report on, typically a tree's root.
+	//!\param registry If given, used to name frames after their branch's registered operation.
+	template<typename T, template<typename, typename> class C, class E>
+	void collapsed(std::ostream& os, const node<T, C, E>& n, const operation_registry<T> *registry = nullptr) const
+	{
+		auto visit = [&os](const std::string&, const std::string&, const std::vector<std::string>& frames, const branch_profile&, std::chrono::nanoseconds exclusive)
+		{
+			if(exclusive.count() == 0) return;
+
+			for(std::size_t i = 0; i != frames.size(); ++i)
+			{
+				os << (i ? ";" : "") << frames[i];
+			}
+
+			os << ' ' << exclusive.count() << '\n';
+		};
+
+		walk(n, registry, visit);
+	}
+
+	//!\brief The measurements of node \c n, or \c nullptr if it is not a branch or if it was not measured.
+	template<typename T, template<typename, typename> class C, class E>
+	const branch_profile* find(const node<T, C, E>& n) const
+	{
+		auto b = dynamic_cast<const detail::default_branch<T, C, E>*>(detail::access::impl(n).get());
+		if(!b) return nullptr;
+
+		auto i = branches.find(&b->l);
+
+		return i == branches.end() ? nullptr : &i->second;
+	}
+};
+
+//!\brief Threading policy that measures branches' evaluations in the current profile.
+//!
+//! Evaluation itself is delegated to \c ThreadingPolicy.
+//! Trees instantiated with other threading policies are not instrumented at all and bear no cost.
+template<class ThreadingPolicy = sequential>
+struct profiled
+{
+	//!\brief Evaluates a branch's children and applies its operation with \c ThreadingPolicy, measuring how long it takes.
+	template<typename O, typename T, template<typename, typename> class C, class E>
+	static T evaluate(const O& o, const node<T, C, E>& l, const node<T, C, E>& r)
+	{
+		profile *p = profile::current();
+		if(!p) return ThreadingPolicy::evaluate(o, l, r);
+
+		auto then = std::chrono::steady_clock::now();
+		T t = ThreadingPolicy::evaluate(o, l, r);
+		p->evaluated(&l, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - then));
+
+		return t;
+	}
+
+	//!\brief Records a cache hit of the branch whose left child is \c l.
+	template<typename N>
+	static void cache_hit(const N& l)
+	{
+		if(profile *p = profile::current())
+		{
+			p->hit(&l);
+		}
+	}
+};
+
+}
+
+#endif
+
+/*!
+\file expression_tree_profile.h
+\brief Per-branch profiling of tree evaluation.
+*/
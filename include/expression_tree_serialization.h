@@ -0,0 +1,481 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_SERIALIZATION_H)
+     #define EXPRESSION_TREE_SERIALIZATION_H
+
+#include "expression_tree.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief Thrown when a tree cannot be saved or loaded.
+class serialization_error : public std::runtime_error
+{
+public:
+	//!\brief Constructor.
+	serialization_error(const std::string& what) : std::runtime_error(what) {}
+};
+
+//!\brief Sequentially reads bytes from a buffer.
+class byte_reader
+{
+	const char *p;		//!< Current position.
+	const char *end;	//!< End of the buffer.
+
+public:
+	//!\brief Constructor.
+	byte_reader(const char *begin, const char *end) : p(begin), end(end) {}
+
+	//!\brief Copies the next \c n bytes to \c destination.
+	void copy(void *destination, std::size_t n)
+	{
+		if(static_cast<std::size_t>(end - p) < n)
+		{
+			throw serialization_error("unexpected end of data");
+		}
+
+		std::memcpy(destination, p, n);
+		p += n;
+	}
+
+	//!\brief Reads the next \c U.
+	template<typename U>
+	U get()
+	{
+		U u;
+		copy(&u, sizeof(U));
+
+		return u;
+	}
+
+	//!\brief Whether all bytes have been read.
+	bool done() const
+	{
+		return p == end;
+	}
+
+	//!\brief The number of bytes left to read.
+	std::size_t remaining() const
+	{
+		return static_cast<std::size_t>(end - p);
+	}
+};
+
+//!\brief Writes and reads leaf values.
+//!
+//! This default implementation copies the value's bytes as-is and thus requires \c T to be trivially copyable.
+//! Specialize this class for other types.
+template<typename T>
+struct value_serializer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "value_serializer must be specialized for types that are not trivially copyable");
+
+	//!\brief Appends \c t to \c out.
+	static void write(std::string& out, const T& t)
+	{
+		out.append(reinterpret_cast<const char*>(&t), sizeof(T));
+	}
+
+	//!\brief Reads a value from \c in.
+	static T read(byte_reader& in)
+	{
+		return in.get<T>();
+	}
+};
+
+//!\brief Writes and reads strings as their length followed by their characters.
+template<typename C, typename Traits, typename Allocator>
+struct value_serializer<std::basic_string<C, Traits, Allocator>>
+{
+	using string_t = std::basic_string<C, Traits, Allocator>;	//!< Convenience alias.
+
+	//!\brief Appends \c s to \c out.
+	static void write(std::string& out, const string_t& s)
+	{
+		value_serializer<std::uint64_t>::write(out, s.size());
+		out.append(reinterpret_cast<const char*>(s.data()), s.size() * sizeof(C));
+	}
+
+	//!\brief Reads a string from \c in.
+	//!
+	//! The length is checked against the bytes left before anything is allocated.
+	static string_t read(byte_reader& in)
+	{
+		auto length = in.get<std::uint64_t>();
+		if(length > in.remaining() / sizeof(C))
+		{
+			throw serialization_error("unexpected end of data");
+		}
+
+		string_t s(static_cast<std::size_t>(length), C());
+		in.copy(&s[0], s.size() * sizeof(C));
+
+		return s;
+	}
+};
+
+namespace detail
+{
+
+//!\brief Kinds of records found in a saved tree.
+enum class record : std::uint8_t
+{
+	empty,		//!< A node that was never assigned to.
+	constant,	//!< A leaf with a constant value.
+	branch		//!< A branch, followed by its operation's index and its two children.
+};
+
+static const char magic[4] = {'E', 'T', 'R', 'E'};	//!< First bytes of a saved tree.
+static const std::uint32_t version = 1;				//!< Version of the format.
+static const std::size_t chunk_size = 1 << 16;		//!< Most bytes read from a stream before checking it has more.
+
+//!\brief Names the kind of a node that can not be saved.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::string unsavable_kind(const node_impl<T> *impl)
+{
+	if(dynamic_cast<const leaf<T*>*>(impl))
+	{
+		return "pointer leaf";
+	}
+	else if(dynamic_cast<const leaf<T (*)()>*>(impl))
+	{
+		return "callable leaf";
+	}
+	else if(dynamic_cast<const unary_branch<T, CachingPolicy, ThreadingPolicy>*>(impl))
+	{
+		return "unary branch";
+	}
+	else if(dynamic_cast<const nary_branch<T, CachingPolicy, ThreadingPolicy>*>(impl))
+	{
+		return "n-ary branch";
+	}
+	else if(dynamic_cast<const lazy_branch<T, CachingPolicy, ThreadingPolicy>*>(impl))
+	{
+		return "lazy branch";
+	}
+	else if(dynamic_cast<const branch_base<T, CachingPolicy, ThreadingPolicy>*>(impl))
+	{
+		return "typed branch";
+	}
+
+	return "unknown node";
+}
+
+//!\brief Reads \c size bytes from \c is to the end of \c out.
+//!
+//! Bytes are read in chunks of at most \c chunk_size so a corrupt size fails at the end of the stream rather than in allocation.
+template<typename Container>
+void read_chunked(std::istream& is, Container& out, std::uint64_t size)
+{
+	if(size > out.max_size() - out.size())
+	{
+		throw serialization_error("unexpected end of stream");
+	}
+
+	while(size)
+	{
+		const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(size, chunk_size)), at = out.size();
+
+		out.resize(at + n);
+		if(!is.read(&out[at], n))
+		{
+			throw serialization_error("unexpected end of stream");
+		}
+
+		size -= n;
+	}
+}
+
+//!\brief Appends a node and its children to \c out in preorder.
+//!
+//! Nodes are visited with an explicit stack, so the depth of a tree is not limited by that of the call stack.
+//!
+//!\param out Where to write.
+//!\param n The node to write.
+//!\param registry The registry the node's operations come from.
+//!\param used Registry identifiers of the operations written so far, in order of first appearance.
+//!\param indices Maps registry identifiers to their position in \c used.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void save_node(std::string& out, const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry, std::vector<operation_id>& used, std::unordered_map<operation_id, std::uint32_t>& indices)
+{
+	std::vector<const node<T, CachingPolicy, ThreadingPolicy>*> pending{&n};
+
+	while(!pending.empty())
+	{
+		const auto& impl = access::impl(*pending.back());
+		pending.pop_back();
+
+		if(!impl)
+		{
+			value_serializer<record>::write(out, record::empty);
+		}
+		else if(auto l = dynamic_cast<const leaf<T>*>(impl.get()))
+		{
+			value_serializer<record>::write(out, record::constant);
+			value_serializer<T>::write(out, l->data());
+		}
+		else if(auto b = dynamic_cast<const default_branch<T, CachingPolicy, ThreadingPolicy>*>(impl.get()))
+		{
+			if(!registry.contains(b->registered))
+			{
+				throw serialization_error("branch operation is not registered");
+			}
+
+			auto i = indices.emplace(b->id, static_cast<std::uint32_t>(used.size()));
+			if(i.second)
+			{
+				used.push_back(b->id);
+			}
+
+			value_serializer<record>::write(out, record::branch);
+			value_serializer<std::uint32_t>::write(out, i.first->second);
+
+			// The left child is written first.
+			pending.push_back(&b->r);
+			pending.push_back(&b->l);
+		}
+		else
+		{
+			throw serialization_error("only constant leaves and registered binary branches can be saved, not a " + unsavable_kind<T, CachingPolicy, ThreadingPolicy>(impl.get()));
+		}
+	}
+}
+
+//!\brief Builds a node's implementation from a preorder sequence of records.
+//!
+//! Children are attached directly to their branch so no modification is propagated up the tree.
+//! Each branch is notified once, after both its children are built, which keeps loading linear.
+//! Branches whose children are being built are kept on an explicit stack, so the depth of a tree is not limited by that of the call stack.
+//!
+//!\param in Where to read.
+//!\param owner The node that will own the returned implementation.
+//!\param operations Registered operations indexed as in the saved tree.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::unique_ptr<node_impl<T>> load_node(byte_reader& in, node<T, CachingPolicy, ThreadingPolicy>* owner, const std::vector<const registered_operation<T>*>& operations)
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;
+	using branch_t = typename CachingPolicy<T, ThreadingPolicy>::branch;
+
+	//!\brief A branch whose children are being built.
+	struct frame
+	{
+		branch_t *b;			//!< The branch.
+		std::size_t built;		//!< Number of its children built so far.
+	};
+
+	std::unique_ptr<node_impl<T>> root;
+	std::vector<frame> pending;
+
+	do
+	{
+		// The node the next record's implementation goes to.
+		node_t *slot = pending.empty() ? owner : pending.back().built ? &pending.back().b->right() : &pending.back().b->left();
+
+		std::unique_ptr<node_impl<T>> impl;
+		branch_t *branch = nullptr;
+
+		switch(value_serializer<record>::read(in))
+		{
+			case record::empty:
+				break;
+
+			case record::constant:
+				impl = std::make_unique<leaf<T>>(value_serializer<T>::read(in));
+				break;
+
+			case record::branch:
+			{
+				auto index = in.get<std::uint32_t>();
+				if(index >= operations.size())
+				{
+					throw serialization_error("invalid operation index");
+				}
+
+				auto b = std::make_unique<branch_t>(operations[index]->f, node_t(slot), node_t(slot));
+				b->id = operations[index]->id;
+				b->registered = operations[index];
+
+				branch = b.get();
+				impl = std::move(b);
+				break;
+			}
+
+			default:
+				throw serialization_error("invalid record");
+		}
+
+		if(pending.empty())
+		{
+			root = std::move(impl);
+		}
+		else
+		{
+			access::impl(*slot) = std::move(impl);
+			++pending.back().built;
+		}
+
+		if(branch)
+		{
+			pending.push_back({branch, 0});
+		}
+
+		// Branches whose children are all built are complete.
+		while(!pending.empty() && pending.back().built == 2)
+		{
+			pending.back().b->modified();
+			pending.pop_back();
+		}
+	}
+	while(!pending.empty());
+
+	return root;
+}
+
+}
+
+//!\brief Saves a node and its children.
+//!
+//! The format is compact and binary. Values are stored in the machine's native byte order.
+//! Operations are stored by name once and referred to by index thereafter.
+//!
+//!\param os Where to save.
+//!\param n The node to save, typically a tree's root.
+//!\param registry The registry the node's operations come from.
+//!\throw serialization_error If a branch's operation was not obtained from \c registry or if a leaf is not constant.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void save(std::ostream& os, const node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry)
+{
+	std::vector<operation_id> used;
+	std::unordered_map<operation_id, std::uint32_t> indices;
+	std::string payload;
+
+	detail::save_node(payload, n, registry, used, indices);
+
+	std::string header(detail::magic, sizeof(detail::magic));
+	value_serializer<std::uint32_t>::write(header, detail::version);
+	value_serializer<std::uint32_t>::write(header, static_cast<std::uint32_t>(used.size()));
+	for(auto id : used)
+	{
+		value_serializer<std::string>::write(header, registry[id].name);
+	}
+	value_serializer<std::uint64_t>::write(header, payload.size());
+
+	os.write(header.data(), header.size());
+	os.write(payload.data(), payload.size());
+}
+
+//!\brief Loads a node and its children.
+//!
+//! Operations are looked up by name in \c registry so it need not have been filled in the same order as when saving.
+//! The saved nodes are read sequentially and built in a single pass.
+//! Counts and lengths are never trusted for allocation: data is read in bounded chunks and storage grows as it arrives.
+//!
+//!\param is Where to load from.
+//!\param n The node to assign to, typically a tree's root.
+//!\param registry The registry to look operations up in.
+//!\throw serialization_error If the data is malformed or if an operation is not found in \c registry.
+//!       In that case, \c n is left unmodified.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void load(std::istream& is, node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry)
+{
+	auto read = [&is](void *destination, std::size_t size)
+	{
+		if(!is.read(static_cast<char*>(destination), size))
+		{
+			throw serialization_error("unexpected end of stream");
+		}
+	};
+
+	char magic[sizeof(detail::magic)];
+	std::uint32_t version, count;
+
+	read(magic, sizeof(magic));
+	read(&version, sizeof(version));
+	if(std::memcmp(magic, detail::magic, sizeof(magic)) != 0 || version != detail::version)
+	{
+		throw serialization_error("not a saved tree");
+	}
+
+	read(&count, sizeof(count));
+	std::vector<const registered_operation<T>*> operations;
+	for(std::uint32_t i = 0; i != count; ++i)
+	{
+		std::uint64_t length;
+		read(&length, sizeof(length));
+
+		std::string name;
+		detail::read_chunked(is, name, length);
+
+		auto o = registry.find(name);
+		if(!o)
+		{
+			throw serialization_error("operation \"" + name + "\" is not registered");
+		}
+
+		operations.push_back(o);
+	}
+
+	std::uint64_t size;
+	read(&size, sizeof(size));
+
+	std::vector<char> payload;
+	detail::read_chunked(is, payload, size);
+
+	byte_reader in(payload.data(), payload.data() + payload.size());
+	auto impl = detail::load_node(in, &n, operations);
+	if(!in.done())
+	{
+		throw serialization_error("trailing data");
+	}
+
+	detail::access::impl(n) = std::move(impl);
+
+	detail::access::notify(n);
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_serialization.h
+\brief Saving and loading of trees whose operations come from an operation_registry.
+*/
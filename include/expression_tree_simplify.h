@@ -0,0 +1,265 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_SIMPLIFY_H)
+     #define EXPRESSION_TREE_SIMPLIFY_H
+
+#include "expression_tree.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace expression_tree
+{
+
+namespace detail
+{
+
+//!\brief Rewrites a tree's branches into equivalent, smaller ones according to their operations' traits.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+class simplifier
+{
+	using node_t = node<T, CachingPolicy, ThreadingPolicy>;
+	using impl_t = std::unique_ptr<node_impl<T>>;
+	using branch_t = typename CachingPolicy<T, ThreadingPolicy>::branch;
+	using default_branch_t = default_branch<T, CachingPolicy, ThreadingPolicy>;
+	using branch_base_t = branch_base<T, CachingPolicy, ThreadingPolicy>;
+
+	const operation_registry<T>& registry;					//!< Where operations' traits come from.
+	const registered_operation<T> *multiplication = nullptr;	//!< What repeated additions become, if registered.
+
+	//!\brief The traits of a branch's operation or \c nullptr if it is not a registered operation.
+	const operation_traits<T>* traits(const default_branch_t *b) const
+	{
+		return b && registry.contains(b->registered) ? &b->registered->traits : nullptr;
+	}
+
+	//!\brief The value of a constant leaf or \c nullptr if \c n is not one.
+	static const T* constant(const node_t& n)
+	{
+		auto l = dynamic_cast<const leaf<T>*>(access::impl(n).get());
+
+		return l ? &l->data() : nullptr;
+	}
+
+	//!\brief Whether evaluating \c n has no side effect.
+	//!
+	//! Callable leaves and operations that were not registered as pure are assumed to have some.
+	bool pure(const node_t& n) const
+	{
+		auto i = access::impl(n).get();
+		if(dynamic_cast<const leaf<T>*>(i) || dynamic_cast<const leaf<T*>*>(i)) return true;
+
+		auto b = dynamic_cast<const default_branch_t*>(i);
+		auto t = traits(b);
+
+		return t && t->pure && pure(b->l) && pure(b->r);
+	}
+
+	//!\brief Whether \c a and \c b are structurally identical pure subtrees.
+	bool same(const node_t& a, const node_t& b) const
+	{
+		auto i = access::impl(a).get(), j = access::impl(b).get();
+
+		if(auto c = dynamic_cast<const leaf<T>*>(i))
+		{
+			auto d = dynamic_cast<const leaf<T>*>(j);
+
+			return d && c->data() == d->data();
+		}
+		else if(auto p = dynamic_cast<const leaf<T*>*>(i))
+		{
+			auto q = dynamic_cast<const leaf<T*>*>(j);
+
+			return q && p->pointer() == q->pointer();
+		}
+
+		auto x = dynamic_cast<const default_branch_t*>(i), y = dynamic_cast<const default_branch_t*>(j);
+		auto t = traits(x);
+
+		return t && t->pure && y && x->registered == y->registered && same(x->l, y->l) && same(x->r, y->r);
+	}
+
+	//!\brief Splits \c n into a term and the number of times it is added, as in <tt>x * 3</tt>.
+	std::pair<node_t*, T> term(node_t& n) const
+	{
+		auto b = dynamic_cast<default_branch_t*>(access::impl(n).get());
+
+		if(multiplication && b && b->registered == multiplication)
+		{
+			if(auto c = constant(b->r)) return {&b->l, *c};
+			if(auto c = constant(b->l)) return {&b->r, *c};
+		}
+
+		return {&n, T(1)};
+	}
+
+	//!\brief Replaces the implementation of \c n.
+	void replace(node_t& n, impl_t impl)
+	{
+		access::impl(n) = std::move(impl);
+		access::adopt(n);
+
+		++rewrites;
+	}
+
+	//!\brief Rewrites branch \c b, which is the implementation of \c n, if its traits allow it.
+	//!
+	//!\return Whether \c n was rewritten.
+	bool rewrite(node_t& n, default_branch_t *b)
+	{
+		auto t = traits(b);
+		if(!t || !t->pure) return false;
+
+		const T *l = constant(b->l), *r = constant(b->r);
+
+		// f(x, identity) is x.
+		if(r && includes(t->identity_side, side::right) && *r == t->identity)
+		{
+			replace(n, std::move(access::impl(b->l)));
+			return true;
+		}
+		else if(l && includes(t->identity_side, side::left) && *l == t->identity)
+		{
+			replace(n, std::move(access::impl(b->r)));
+			return true;
+		}
+
+		// f(x, absorbing) is absorbing, as long as evaluating x has no side effect.
+		if((r && includes(t->absorbing_side, side::right) && *r == t->absorbing && pure(b->l)) ||
+		   (l && includes(t->absorbing_side, side::left) && *l == t->absorbing && pure(b->r)))
+		{
+			replace(n, impl_t(new leaf<T>(t->absorbing)));
+			return true;
+		}
+
+		// x * a + x * b is x * (a + b), for exact additions only.
+		if(multiplication && t->kind == arithmetic::addition && t->associative && t->commutative)
+		{
+			auto x = term(b->l), y = term(b->r);
+
+			if(!constant(*x.first) && same(*x.first, *y.first))
+			{
+				auto m = std::make_unique<branch_t>(multiplication->f, node_t(), node_t());
+				m->id = multiplication->id;
+				m->registered = multiplication;
+
+				access::impl(m->left()) = std::move(access::impl(*x.first));
+				access::impl(m->right()) = impl_t(new leaf<T>(b->f(x.second, y.second)));
+				access::adopt(m->left());
+
+				m->modified();
+
+				replace(n, impl_t(std::move(m)));
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+public:
+	std::size_t rewrites = 0;	//!< Number of branches rewritten so far.
+
+	//!\brief Constructor.
+	simplifier(const operation_registry<T>& registry) : registry(registry)
+	{
+		for(operation_id i = 0; i != registry.size() && !multiplication; ++i)
+		{
+			if(registry[i].traits.kind == arithmetic::multiplication)
+			{
+				multiplication = &registry[i];
+			}
+		}
+	}
+
+	//!\brief Simplifies \c n's children, then \c n.
+	//!
+	//!\return Whether \c n or any of its descendants was rewritten.
+	bool simplify(node_t& n)
+	{
+		auto base = dynamic_cast<branch_base_t*>(access::impl(n).get());
+		if(!base) return false;
+
+		bool modified = false;
+		for(std::size_t i = 0; i != base->arity(); ++i)
+		{
+			modified |= simplify(base->child(i));
+		}
+
+		if(rewrite(n, dynamic_cast<default_branch_t*>(base)))
+		{
+			return true;
+		}
+
+		if(modified)
+		{
+			base->modified();
+		}
+
+		return modified;
+	}
+};
+
+}
+
+//!\brief Rewrites a tree into an equivalent one with fewer nodes, according to its operations' traits.
+//!
+//! Branches are rewritten bottom-up:
+//! - a branch whose operation is applied to its identity element is replaced with its other child, as in <tt>x * 1</tt> or <tt>x + 0</tt>,
+//! - a branch whose operation is applied to its absorbing element is replaced with that element, as in <tt>x * 0</tt>,
+//! - an exact addition of a term to itself is replaced with a multiplication, as in <tt>x + x</tt> or <tt>x * 2 + x</tt>, if a multiplication is registered.
+//!
+//! Only branches whose registered operation is pure are rewritten, and subtrees are only discarded if evaluating them has no side effect.
+//! Each rewritten branch is notified once, and so is the parent of \c n.
+//!
+//!\param n The node to simplify, typically a tree's root.
+//!\param registry Where the operations' traits come from.
+//!\return The number of branches that were rewritten.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::size_t simplify(node<T, CachingPolicy, ThreadingPolicy>& n, const operation_registry<T>& registry)
+{
+	detail::simplifier<T, CachingPolicy, ThreadingPolicy> s(registry);
+
+	if(s.simplify(n))
+	{
+		detail::access::notify(n);
+	}
+
+	return s.rewrites;
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_simplify.h
+\brief Algebraic simplification of trees.
+*/
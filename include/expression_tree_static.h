@@ -0,0 +1,330 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_STATIC_H)
+     #define EXPRESSION_TREE_STATIC_H
+
+#include "expression_tree.h"
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace expression_tree
+{
+
+//!\brief Leaf of a static tree with a constant value.
+template<typename T>
+class static_constant
+{
+	T value;	//!< This leaf's value.
+
+public:
+	using value_type = T;	//!< Type of this leaf's value.
+
+	static constexpr bool is_constant = true;	//!< Whether this node's value is known when it is built.
+
+	//!\brief Constructor.
+	constexpr explicit static_constant(const T& value) : value(value) {}
+
+	//!\brief Returns this leaf's value.
+	constexpr const T& evaluate() const
+	{
+		return value;
+	}
+
+	//!\brief Returns \c true.
+	constexpr bool constant() const
+	{
+		return is_constant;
+	}
+
+	//!\brief Assigns this leaf's value to a node.
+	template<typename N>
+	void assign_to(N& n) const
+	{
+		n = value;
+	}
+};
+
+template<typename T>
+constexpr bool static_constant<T>::is_constant;
+
+//!\brief Leaf of a static tree that points to a variable.
+template<typename T>
+class static_variable
+{
+	const T *p;	//!< The variable this leaf points to.
+
+public:
+	using value_type = T;	//!< Type of this leaf's value.
+
+	static constexpr bool is_constant = false;	//!< Whether this node's value is known when it is built.
+
+	//!\brief Constructor.
+	constexpr explicit static_variable(const T *p) : p(p) {}
+
+	//!\brief Returns the value of the variable this leaf points to.
+	constexpr const T& evaluate() const
+	{
+		return *p;
+	}
+
+	//!\brief Returns \c false.
+	constexpr bool constant() const
+	{
+		return is_constant;
+	}
+
+	//!\brief Assigns this leaf's pointer to a node.
+	template<typename N>
+	void assign_to(N& n) const
+	{
+		n = p;
+	}
+};
+
+template<typename T>
+constexpr bool static_variable<T>::is_constant;
+
+//!\brief Leaf of a static tree whose value is the result of a callable.
+template<typename T, typename F>
+class static_callable
+{
+	F f;	//!< The callable.
+
+public:
+	using value_type = T;	//!< Type of this leaf's value.
+
+	static constexpr bool is_constant = false;	//!< Whether this node's value is known when it is built.
+
+	//!\brief Constructor.
+	constexpr explicit static_callable(const F& f) : f(f) {}
+
+	//!\brief Returns the result of this leaf's callable.
+	constexpr T evaluate() const
+	{
+		return f();
+	}
+
+	//!\brief Returns \c false.
+	constexpr bool constant() const
+	{
+		return is_constant;
+	}
+
+	//!\brief Assigns this leaf's callable to a node.
+	template<typename N>
+	void assign_to(N& n) const
+	{
+		n = std::function<T ()>(f);
+	}
+};
+
+template<typename T, typename F>
+constexpr bool static_callable<T, F>::is_constant;
+
+//!\brief Branch of a static tree.
+//!
+//! The operation is applied to the children's values every time the branch is evaluated.
+//!
+//!\param O Type of the operation, taking two \c value_type and returning a \c value_type.
+//!\param L Type of the left child.
+//!\param R Type of the right child.
+//!\param Constant Whether both children are constant.
+template<typename O, typename L, typename R, bool Constant = L::is_constant && R::is_constant>
+class static_branch
+{
+	O o;	//!< The operation.
+	L l;	//!< The left child.
+	R r;	//!< The right child.
+
+public:
+	using value_type = typename L::value_type;	//!< Type of this branch's value.
+
+	static constexpr bool is_constant = false;	//!< Whether this node's value is known when it is built.
+
+	//!\brief Constructor.
+	constexpr static_branch(const O& o, const L& l, const R& r) : o(o), l(l), r(r) {}
+
+	//!\brief Applies the operation to the children's values.
+	constexpr value_type evaluate() const
+	{
+		return o(l.evaluate(), r.evaluate());
+	}
+
+	//!\brief Returns \c false.
+	constexpr bool constant() const
+	{
+		return is_constant;
+	}
+
+	//!\brief Builds the equivalent branch in a node.
+	template<typename N>
+	void assign_to(N& n) const
+	{
+		n = detail::operation<value_type>(o);
+		l.assign_to(n.left());
+		r.assign_to(n.right());
+	}
+};
+
+template<typename O, typename L, typename R, bool Constant>
+constexpr bool static_branch<O, L, R, Constant>::is_constant;
+
+//!\brief Branch of a static tree whose children are both constant.
+//!
+//! The operation is applied once, when the branch is built, and only its result is kept.
+//! If the operation can be applied in a constant expression, so can the branch be built.
+template<typename O, typename L, typename R>
+class static_branch<O, L, R, true>
+{
+public:
+	using value_type = typename L::value_type;	//!< Type of this branch's value.
+
+private:
+	value_type value;	//!< The operation's result.
+
+public:
+	static constexpr bool is_constant = true;	//!< Whether this node's value is known when it is built.
+
+	//!\brief Constructor.
+	constexpr static_branch(const O& o, const L& l, const R& r) : value(o(l.evaluate(), r.evaluate())) {}
+
+	//!\brief Returns the operation's result.
+	constexpr const value_type& evaluate() const
+	{
+		return value;
+	}
+
+	//!\brief Returns \c true.
+	constexpr bool constant() const
+	{
+		return is_constant;
+	}
+
+	//!\brief Assigns the operation's result to a node.
+	template<typename N>
+	void assign_to(N& n) const
+	{
+		n = value;
+	}
+};
+
+template<typename O, typename L, typename R>
+constexpr bool static_branch<O, L, R, true>::is_constant;
+
+//!\brief Whether \c N is a node of a static tree.
+template<typename N>
+struct is_static_node : std::false_type {};
+
+//!\brief Constant leaves are static nodes.
+template<typename T>
+struct is_static_node<static_constant<T>> : std::true_type {};
+
+//!\brief Variable leaves are static nodes.
+template<typename T>
+struct is_static_node<static_variable<T>> : std::true_type {};
+
+//!\brief Callable leaves are static nodes.
+template<typename T, typename F>
+struct is_static_node<static_callable<T, F>> : std::true_type {};
+
+//!\brief Branches are static nodes.
+template<typename O, typename L, typename R, bool Constant>
+struct is_static_node<static_branch<O, L, R, Constant>> : std::true_type {};
+
+//!\brief Makes a constant leaf.
+template<typename T>
+constexpr static_constant<T> make_constant(const T& t)
+{
+	return static_constant<T>(t);
+}
+
+//!\brief Makes a leaf that points to a variable.
+template<typename T>
+constexpr static_variable<T> make_variable(const T& t)
+{
+	return static_variable<T>(&t);
+}
+
+//!\brief Makes a leaf whose value is the result of a callable.
+template<typename T, typename F>
+constexpr static_callable<T, F> make_callable(const F& f)
+{
+	return static_callable<T, F>(f);
+}
+
+//!\brief Makes a branch.
+//!
+//! If both children are constant, the operation is applied immediately.
+template<typename O, typename L, typename R>
+constexpr static_branch<O, L, R> make_branch(const O& o, const L& l, const R& r)
+{
+	static_assert(is_static_node<L>::value && is_static_node<R>::value, "children must be static nodes");
+	static_assert(std::is_same<typename L::value_type, typename R::value_type>::value, "children must have the same value type");
+
+	return static_branch<O, L, R>(o, l, r);
+}
+
+//!\brief Makes a branch that adds its children's values.
+template<typename L, typename R, typename = std::enable_if_t<is_static_node<L>::value && is_static_node<R>::value>>
+constexpr auto operator+(const L& l, const R& r)
+{
+	return make_branch(std::plus<typename L::value_type>(), l, r);
+}
+
+//!\brief Makes a branch that subtracts its children's values.
+template<typename L, typename R, typename = std::enable_if_t<is_static_node<L>::value && is_static_node<R>::value>>
+constexpr auto operator-(const L& l, const R& r)
+{
+	return make_branch(std::minus<typename L::value_type>(), l, r);
+}
+
+//!\brief Makes a branch that multiplies its children's values.
+template<typename L, typename R, typename = std::enable_if_t<is_static_node<L>::value && is_static_node<R>::value>>
+constexpr auto operator*(const L& l, const R& r)
+{
+	return make_branch(std::multiplies<typename L::value_type>(), l, r);
+}
+
+//!\brief Makes a branch that divides its children's values.
+template<typename L, typename R, typename = std::enable_if_t<is_static_node<L>::value && is_static_node<R>::value>>
+constexpr auto operator/(const L& l, const R& r)
+{
+	return make_branch(std::divides<typename L::value_type>(), l, r);
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_static.h
+\brief Trees whose shape is known at compile time.
+*/
@@ -0,0 +1,472 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+
+#if !defined(EXPRESSION_TREE_STREAM_H)
+     #define EXPRESSION_TREE_STREAM_H
+
+#include "expression_tree.h"
+#include "expression_tree_parser.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace expression_tree
+{
+
+//!\brief Tuning of stream evaluation.
+struct stream_options
+{
+	std::size_t block_size = 4096;		//!< Number of records handed from one stage to the next at once.
+	std::size_t queue_depth = 4;		//!< Number of blocks that may wait between two stages.
+	std::size_t read_size = 1 << 20;	//!< Number of bytes read at once from CSV input.
+	char separator = ',';				//!< Separates CSV fields.
+	bool header = false;				//!< Whether the first line of CSV input names the columns and is to be skipped.
+};
+
+namespace detail
+{
+
+//!\brief Bounded, closable queue that hands blocks from one pipeline stage to the next.
+template<typename U>
+class channel
+{
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<U> items;
+	std::size_t capacity;
+	bool closed = false;
+
+public:
+	//!\brief Constructor.
+	channel(std::size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+	//!\brief Waits for room and pushes \c u.
+	//!
+	//!\return \c false if the channel was closed, in which case \c u is dropped.
+	bool push(U u)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [this]{ return closed || items.size() < capacity; });
+
+		if(closed) return false;
+
+		items.push_back(std::move(u));
+		cv.notify_all();
+
+		return true;
+	}
+
+	//!\brief Waits for an item and pops it.
+	//!
+	//!\return \c false if the channel is closed and empty.
+	bool pop(U& u)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [this]{ return closed || !items.empty(); });
+
+		if(items.empty()) return false;
+
+		u = std::move(items.front());
+		items.pop_front();
+		cv.notify_all();
+
+		return true;
+	}
+
+	//!\brief Closes the channel. Pending items can still be popped.
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		closed = true;
+		cv.notify_all();
+	}
+};
+
+//!\brief Runs the stages of a stream evaluation, each on its own thread but the last.
+//!
+//! The first exception thrown by a stage closes all channels, which winds the other stages down, and is rethrown.
+class pipeline
+{
+	std::vector<std::thread> threads;
+	std::mutex m;
+	std::exception_ptr error;
+	std::vector<std::function<void ()>> closers;
+
+public:
+	//!\brief Closes \c c when the pipeline fails.
+	template<typename U>
+	void track(channel<U>& c)
+	{
+		closers.push_back([&c]{ c.close(); });
+	}
+
+	//!\brief Runs \c f on the calling thread, recording its exception if any.
+	template<typename F>
+	void run(F f)
+	{
+		try
+		{
+			f();
+		}
+		catch(...)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m);
+				if(!error) error = std::current_exception();
+			}
+
+			for(auto& c : closers) c();
+		}
+	}
+
+	//!\brief Runs \c f on its own thread.
+	//!
+	//! If the thread can not be started, the stages already running are wound down and joined before the exception is propagated.
+	template<typename F>
+	void spawn(F f)
+	{
+		try
+		{
+			threads.emplace_back([this, f]{ run(f); });
+		}
+		catch(...)
+		{
+			for(auto& c : closers) c();
+			for(auto& t : threads) t.join();
+			threads.clear();
+
+			throw;
+		}
+	}
+
+	//!\brief Waits for all stages and rethrows the first exception.
+	void join()
+	{
+		for(auto& t : threads) t.join();
+
+		if(error) std::rethrow_exception(error);
+	}
+};
+
+//!\brief Evaluates blocks of records and passes blocks of results on.
+//!
+//!\param records Row-major blocks of records of \c columns.size() values each.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+void evaluate_blocks(const node<T, CachingPolicy, ThreadingPolicy>& n, const std::vector<T*>& columns, channel<std::vector<T>>& records, channel<std::vector<T>>& results)
+{
+	std::vector<T> block;
+	while(records.pop(block))
+	{
+		std::vector<T> values;
+		values.reserve(block.size() / columns.size());
+
+		for(auto r = block.begin(); r != block.end(); r += columns.size())
+		{
+			for(std::size_t c = 0; c != columns.size(); ++c)
+			{
+				if(columns[c]) *columns[c] = r[c];
+			}
+
+			values.push_back(n.evaluate());
+		}
+
+		if(!results.push(std::move(values))) break;
+	}
+
+	results.close();
+}
+
+//!\brief Parses a CSV field starting at \c p.
+//!
+//! The value must be followed by nothing but blanks up to the next separator or the end of the record, where \c p is left.
+template<typename T>
+T field(const char*& p, char separator, std::size_t record)
+{
+	while(*p == ' ' || *p == '\t') ++p;
+
+	T t;
+	if(!literal<T>::parse(p, t))
+	{
+		throw std::runtime_error("malformed field in record " + std::to_string(record));
+	}
+
+	while(*p == ' ' || *p == '\t' || *p == '\r') ++p;
+
+	if(*p && *p != separator)
+	{
+		throw std::runtime_error("malformed field in record " + std::to_string(record));
+	}
+
+	return t;
+}
+
+}
+
+//!\brief Evaluates a tree once per record of CSV input.
+//!
+//! Reading, parsing, evaluating and writing are pipelined on separate threads
+//! so that evaluation proceeds while the next records are being read and parsed.
+//! For each record, the value of each field is assigned to the variable bound to its column and then the tree is evaluated.
+//! Results are written one per line.
+//!
+//!\param in The CSV input. Fields are parsed by literal.
+//!\param out Where to write results.
+//!\param n The node to evaluate, typically a tree's root. Its pointer leaves should point to variables in \c columns.
+//!\param columns The variable each column is assigned to, or \c nullptr to ignore a column.
+//!\param options Tuning.
+//!\return The number of records evaluated.
+//!\throw std::invalid_argument If there are no columns.
+//!\throw std::runtime_error If a record does not have as many fields as there are columns or if a field is malformed, such as \c 3.5 read as an \c int.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::size_t evaluate_csv(std::istream& in, std::ostream& out, const node<T, CachingPolicy, ThreadingPolicy>& n, const std::vector<T*>& columns, const stream_options& options = stream_options())
+{
+	if(columns.empty())
+	{
+		throw std::invalid_argument("records must have at least one column");
+	}
+
+	detail::channel<std::string> chunks(options.queue_depth);
+	detail::channel<std::vector<T>> records(options.queue_depth), results(options.queue_depth);
+	detail::pipeline p;
+	std::size_t count = 0;
+
+	p.track(chunks);
+	p.track(records);
+	p.track(results);
+
+	// Reads chunks made of whole lines.
+	p.spawn([&]
+	{
+		std::string carry;
+		bool skip = options.header;
+
+		while(in)
+		{
+			std::string chunk(std::move(carry));
+			std::size_t size = chunk.size();
+
+			chunk.resize(size + options.read_size);
+			in.read(&chunk[size], options.read_size);
+			chunk.resize(size + static_cast<std::size_t>(in.gcount()));
+
+			std::size_t end = in ? chunk.rfind('\n') : chunk.size();
+			if(end == std::string::npos)
+			{
+				carry = std::move(chunk);
+				continue;
+			}
+
+			carry = chunk.substr(std::min(end + 1, chunk.size()));
+			chunk.resize(end);
+
+			if(skip)
+			{
+				auto eol = chunk.find('\n');
+				chunk.erase(0, eol == std::string::npos ? chunk.size() : eol + 1);
+				skip = false;
+			}
+
+			if(!chunks.push(std::move(chunk))) break;
+		}
+
+		chunks.close();
+	});
+
+	// Parses lines into blocks of records.
+	p.spawn([&]
+	{
+		std::string chunk;
+		std::vector<T> block;
+		std::size_t record = 0;
+
+		while(chunks.pop(chunk))
+		{
+			for(const char *l = chunk.c_str(); *l; )
+			{
+				const char *eol = std::strchr(l, '\n');
+				if(!eol) eol = l + std::strlen(l);
+
+				std::string line(l, eol);
+				l = *eol ? eol + 1 : eol;
+
+				if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+				++record;
+
+				const char *f = line.c_str();
+				for(std::size_t c = 0; c != columns.size(); ++c)
+				{
+					if(c && *f++ != options.separator)
+					{
+						throw std::runtime_error("too few fields in record " + std::to_string(record));
+					}
+
+					block.push_back(detail::field<T>(f, options.separator, record));
+				}
+
+				if(*f)
+				{
+					throw std::runtime_error("too many fields in record " + std::to_string(record));
+				}
+
+				if(block.size() >= options.block_size * columns.size())
+				{
+					if(!records.push(std::move(block))) return;
+					block.clear();
+				}
+			}
+		}
+
+		if(!block.empty()) records.push(std::move(block));
+
+		records.close();
+	});
+
+	p.spawn([&]{ detail::evaluate_blocks(n, columns, records, results); });
+
+	p.run([&]
+	{
+		std::vector<T> block;
+		std::ostringstream formatted;
+
+		formatted.copyfmt(out);
+
+		while(results.pop(block))
+		{
+			formatted.str(std::string());
+
+			for(const auto& t : block)
+			{
+				formatted << t << '\n';
+			}
+
+			out << formatted.str();
+			count += block.size();
+		}
+	});
+
+	p.join();
+
+	return count;
+}
+
+//!\brief Evaluates a tree once per record of binary input.
+//!
+//! Records are made of as many \c T as there are columns, stored in the machine's native byte order.
+//! Reading, evaluating and writing are pipelined on separate threads
+//! so that evaluation proceeds while the next records are being read.
+//! Results are written as \c T, stored in the machine's native byte order.
+//!
+//!\param in The binary input.
+//!\param out Where to write results.
+//!\param n The node to evaluate, typically a tree's root. Its pointer leaves should point to variables in \c columns.
+//!\param columns The variable each column is assigned to, or \c nullptr to ignore a column.
+//!\param options Tuning.
+//!\return The number of records evaluated.
+//!\throw std::invalid_argument If there are no columns.
+//!\throw std::runtime_error If the input ends in the middle of a record.
+template<typename T, template<typename, typename> class CachingPolicy, class ThreadingPolicy>
+std::size_t evaluate_binary(std::istream& in, std::ostream& out, const node<T, CachingPolicy, ThreadingPolicy>& n, const std::vector<T*>& columns, const stream_options& options = stream_options())
+{
+	static_assert(std::is_trivially_copyable<T>::value, "binary records require trivially copyable values");
+
+	if(columns.empty())
+	{
+		throw std::invalid_argument("records must have at least one column");
+	}
+
+	detail::channel<std::vector<T>> records(options.queue_depth), results(options.queue_depth);
+	detail::pipeline p;
+	std::size_t count = 0;
+
+	p.track(records);
+	p.track(results);
+
+	p.spawn([&]
+	{
+		while(in)
+		{
+			std::vector<T> block(options.block_size * columns.size());
+
+			in.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(T));
+
+			std::size_t read = static_cast<std::size_t>(in.gcount());
+			if(read % (columns.size() * sizeof(T)))
+			{
+				throw std::runtime_error("truncated record");
+			}
+
+			block.resize(read / sizeof(T));
+
+			if(!block.empty() && !records.push(std::move(block))) break;
+		}
+
+		records.close();
+	});
+
+	p.spawn([&]{ detail::evaluate_blocks(n, columns, records, results); });
+
+	p.run([&]
+	{
+		std::vector<T> block;
+
+		while(results.pop(block))
+		{
+			out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(T));
+			count += block.size();
+		}
+	});
+
+	p.join();
+
+	return count;
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_stream.h
+\brief Pipelined evaluation of a tree over streams of records.
+*/
@@ -0,0 +1,217 @@
+/*
+	(C) Copyright Thierry Seegers 2010-2014. Distributed under the following license:
+
+	Boost Software License - Version 1.0 - August 17th, 2003
+
+	Permission is hereby granted, free of charge, to any person or organization
+	obtaining a copy of the software and accompanying documentation covered by
+	this license (the "Software") to use, reproduce, display, distribute,
+	execute, and transmit the Software, and to prepare derivative works of the
+	Software, and to permit third-parties to whom the Software is furnished to
+	do so, all subject to the following:
+
+	The copyright notices in the Software and this entire statement, including
+	the above license grant, this restriction and the following disclaimer,
+	must be included in all copies of the Software, in whole or in part, and
+	all derivative works of the Software, unless such copies or derivative
+	works are solely in the form of machine-executable object code generated by
+	a source language processor.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+	SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+	FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+	ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+*/
+
+#if !defined(EXPRESSION_TREE_WORKERS_H)
+     #define EXPRESSION_TREE_WORKERS_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace expression_tree
+{
+
+namespace detail
+{
+
+//!\brief Threads kept alive between parallel evaluations, so that evaluating does not start any.
+//!
+//! Threads are started the first time they are needed and wait for the next job once they are done.
+//! Each crew reserves threads of its own, so that concurrent and nested evaluations do not wait for one another.
+//! Threads are started when no reserved one is free, and the pool keeps as many as were ever reserved at once.
+class worker_pool
+{
+	//!\brief A request for one thread to run a crew's job.
+	struct task
+	{
+		const std::function<void ()> *job;	//!< The job to run.
+		std::size_t *busy;					//!< The number of the crew's threads that have not finished the job.
+	};
+
+	std::mutex m;
+	std::condition_variable wake;	//!< Signals a new task or stopping.
+	std::condition_variable idle;	//!< Signals that a thread finished a task.
+	std::vector<std::thread> threads;
+	std::vector<task> tasks;		//!< Tasks no thread picked up yet.
+	std::size_t free = 0;			//!< Number of threads no crew reserved.
+	bool stopping = false;
+
+	friend class workers;
+
+	//!\brief What each thread does until the pool is destroyed.
+	void serve()
+	{
+		std::unique_lock<std::mutex> lock(m);
+
+		while(true)
+		{
+			wake.wait(lock, [this]{ return stopping || !tasks.empty(); });
+			if(stopping) return;
+
+			task t = tasks.back();
+			tasks.pop_back();
+
+			lock.unlock();
+			(*t.job)();
+			lock.lock();
+
+			if(!--*t.busy) idle.notify_all();
+		}
+	}
+
+	//!\brief Reserves \c n threads, starting as many as there are not enough free ones, or as can be started.
+	//!
+	//! As many tasks are never posted as threads are reserved, so every posted task is picked up.
+	//!
+	//!\return The number of threads reserved, at most \c n.
+	std::size_t reserve(std::size_t n)
+	{
+		std::lock_guard<std::mutex> lock(m);
+
+		std::size_t reserved = std::min(n, free);
+		free -= reserved;
+
+		try
+		{
+			for(; reserved != n; ++reserved)
+			{
+				threads.emplace_back([this]{ serve(); });
+			}
+		}
+		catch(const std::system_error&)
+		{}
+
+		return reserved;
+	}
+
+	//!\brief Makes \c n reserved threads free again.
+	void release(std::size_t n)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		free += n;
+	}
+
+	//!\brief Runs \c f on \c n reserved threads and on the calling thread, and waits for all of them to return.
+	void run(std::size_t n, const std::function<void ()>& f)
+	{
+		std::size_t busy = n;
+
+		{
+			std::lock_guard<std::mutex> lock(m);
+			tasks.insert(tasks.end(), n, task{&f, &busy});
+		}
+		wake.notify_all();
+
+		f();
+
+		std::unique_lock<std::mutex> lock(m);
+		idle.wait(lock, [&busy]{ return !busy; });
+	}
+
+public:
+	worker_pool() = default;
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+
+	//!\brief Stops and joins all threads.
+	~worker_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for(auto& t : threads)
+		{
+			t.join();
+		}
+	}
+
+	//!\brief The pool shared by all parallel evaluations.
+	static worker_pool& shared()
+	{
+		static worker_pool pool;
+
+		return pool;
+	}
+};
+
+//!\brief Threads of the shared worker_pool reserved for one parallel evaluation.
+//!
+//! Concurrent evaluations, and evaluations nested in an operation, each reserve their own threads.
+class workers
+{
+	worker_pool& pool;
+	std::size_t count;	//!< Number of threads, the calling one included.
+
+public:
+	//!\brief Constructor.
+	//!
+	//!\param threads Number of threads wanted, the calling one included.
+	workers(std::size_t threads) : pool(worker_pool::shared()), count(1 + (threads > 1 ? pool.reserve(threads - 1) : 0)) {}
+
+	workers(const workers&) = delete;
+	workers& operator=(const workers&) = delete;
+
+	//!\brief Releases the reserved threads.
+	~workers()
+	{
+		pool.release(count - 1);
+	}
+
+	//!\brief Number of threads that run a job, the calling one included. It is less than wanted only if threads can not be started.
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	//!\brief Runs \c job on size() threads at once and waits for all of them to return.
+	//!
+	//! \c job must not throw.
+	void run(const std::function<void ()>& job)
+	{
+		if(count == 1) job();
+		else pool.run(count - 1, job);
+	}
+};
+
+}
+
+}
+
+#endif
+
+/*!
+\file expression_tree_workers.h
+\brief Threads shared by the parallel evaluations of frozen trees and forests.
+*/
@@ -1,10 +1,28 @@
 #include "expression_tree.h"
+#include "expression_tree_codegen.h"
+#include "expression_tree_forest.h"
+#include "expression_tree_frozen.h"
+#include "expression_tree_image.h"
+#include "expression_tree_parser.h"
+#include "expression_tree_pool.h"
+#include "expression_tree_profile.h"
+#include "expression_tree_serialization.h"
+#include "expression_tree_simplify.h"
+#include "expression_tree_static.h"
+#include "expression_tree_stream.h"
+#include "expression_tree_workers.h"
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include <limits>
+#include <sstream>
 #include <string>
 
 using namespace expression_tree;
@@ -198,4 +216,1813 @@ auto grow_prune = [](auto&& tree)
 TEST_CASE("grow_prune", "Grow and prune a tree by copying branches and leaves.")
 {
     all_policies<int>(grow_prune);
-}
\ No newline at end of file
+}
+
+auto save_load = [](auto&& tree)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& subtract = registry.add("subtract", minus<int>());
+
+	tree.root() = add;
+	tree.left() = subtract;
+	tree.left().left() = 7;
+	tree.left().right() = 2;
+	tree.right() = add;
+	tree.right().left() = 3;
+	tree.right().right() = subtract;
+	tree.right().right().left() = 4;
+	tree.right().right().right() = 1;
+	REQUIRE(tree.evaluate() == 11);
+
+	stringstream ss;
+	save(ss, tree, registry);
+
+	// Operations are found by name, regardless of their identifier.
+	operation_registry<int> other;
+	other.add("subtract", minus<int>());
+	other.add("add", plus<int>());
+
+	std::decay_t<decltype(tree)> loaded;
+	load(ss, loaded.root(), other);
+	REQUIRE(loaded.evaluate() == 11);
+
+	// A loaded tree remains modifiable.
+	loaded.right().right().right() = 4;
+	REQUIRE(loaded.evaluate() == 8);
+
+	// Branches with unregistered operations can not be saved.
+	tree.right() = multiplies<int>();
+	REQUIRE_THROWS_AS(save(ss, tree, registry), const serialization_error&);
+
+	// Nor can branches whose operation comes from another registry, even if its identifier is registered.
+	tree.right() = *other.find("subtract");
+	tree.right().left() = 3;
+	tree.right().right() = 1;
+	REQUIRE(tree.right().operation() == add.id);
+	REQUIRE_THROWS_AS(save(ss, tree, registry), const serialization_error&);
+
+	// Errors name the kind of node that can not be saved.
+	int x = 0;
+	tree.right() = &x;
+	try
+	{
+		save(ss, tree, registry);
+		FAIL("a pointer leaf was saved");
+	}
+	catch(const serialization_error& e)
+	{
+		REQUIRE(string(e.what()).find("pointer leaf") != string::npos);
+	}
+};
+
+TEST_CASE("save_load", "Save a tree and load it back.")
+{
+	all_policies<int>(save_load);
+
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+
+	// Deep trees are saved and loaded without recursion: 1 + (1 + (1 + ...)).
+	tree<int> deep;
+	auto *n = &deep.root();
+	for(int i = 0; i != 5000; ++i)
+	{
+		*n = add;
+		n->left() = 1;
+		n = &n->right();
+	}
+	*n = 0;
+
+	stringstream ss;
+	save(ss, deep, registry);
+
+	tree<int> loaded;
+	load(ss, loaded.root(), registry);
+	REQUIRE(loaded.evaluate() == 5000);
+
+	// Corrupt counts and lengths fail at the end of the data rather than in allocation, and leave the node as it was.
+	// A saved tree starts with its magic, version and operation count, then the operation's name length, name and payload size.
+	stringstream small;
+	tree<int> one;
+	one.root() = add;
+	one.left() = 1;
+	one.right() = 2;
+	save(small, one, registry);
+	const string bytes = small.str();
+
+	auto corrupt = [&](std::size_t offset, auto value)
+	{
+		string damaged(bytes);
+		memcpy(&damaged[offset], &value, sizeof(value));
+
+		stringstream ds(damaged);
+		load(ds, loaded.root(), registry);
+	};
+
+	REQUIRE_NOTHROW(corrupt(0, bytes[0]));
+	REQUIRE_THROWS_AS(corrupt(8, std::uint32_t(0xFFFFFFFF)), const serialization_error&);
+	REQUIRE_THROWS_AS(corrupt(12, std::uint64_t(1) << 60), const serialization_error&);
+	REQUIRE_THROWS_AS(corrupt(12 + 8 + 3, std::uint64_t(1) << 60), const serialization_error&);
+	REQUIRE_THROWS_AS(corrupt(12 + 8 + 3, ~std::uint64_t(0)), const serialization_error&);
+	REQUIRE(loaded.evaluate() == 3);
+
+	string length(sizeof(std::uint64_t), '\0');
+	const std::uint64_t huge = std::uint64_t(1) << 60;
+	memcpy(&length[0], &huge, sizeof(huge));
+	byte_reader reader(length.data(), length.data() + length.size());
+	REQUIRE_THROWS_AS(value_serializer<string>::read(reader), const serialization_error&);
+}
+
+auto image = [](auto&& tree)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+
+	int x = 5, y = 7;
+
+	tree.root() = add;
+	tree.left() = multiply;
+	tree.left().left() = 3;
+	tree.left().right() = &x;
+	tree.right() = &y;
+	REQUIRE(tree.evaluate() == 22);
+
+	stringstream ss;
+	write_image(ss, tree, registry, {&x, &y});
+
+	string bytes = ss.str();
+	vector<std::uint64_t> aligned(bytes.size() / sizeof(std::uint64_t) + 1);
+	memcpy(aligned.data(), bytes.data(), bytes.size());
+
+	image_view<int> view(aligned.data(), bytes.size(), registry);
+	int variables[] = {5, 7};
+	REQUIRE(view.evaluate(variables) == 22);
+
+	variables[0] = 1;
+	REQUIRE(view.evaluate(variables) == 10);
+
+	{
+		ofstream("image.bin", ios::binary) << bytes;
+		mapped_image<int> mapped("image.bin", registry);
+		REQUIRE(mapped.evaluate(variables) == 10);
+	}
+	remove("image.bin");
+
+	// The image knows how many variables it needs.
+	REQUIRE(view.variables() == 2);
+	REQUIRE(view.evaluate(variables, 2) == 10);
+	REQUIRE_THROWS_AS(view.evaluate(), const invalid_argument&);
+	REQUIRE_THROWS_AS(view.evaluate(variables, 1), const invalid_argument&);
+
+	// Damaged images are rejected before they are evaluated.
+	detail::image_header header;
+	memcpy(&header, bytes.data(), sizeof(header));
+
+	auto damaged = [&](auto damage)
+	{
+		vector<std::uint64_t> copy(aligned);
+		damage(reinterpret_cast<char*>(copy.data()));
+		return [copy, &bytes, &registry]{ image_view<int>(copy.data(), bytes.size(), registry); };
+	};
+	auto node = [&](char *data, std::uint32_t i){ return reinterpret_cast<detail::image_node*>(data + header.nodes_offset) + i; };
+
+	REQUIRE_NOTHROW(damaged([](char*){})());
+	REQUIRE_THROWS_AS(damaged([&](char *data){ reinterpret_cast<detail::image_header*>(data)->values_offset = header.size + 8; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ reinterpret_cast<detail::image_header*>(data)->node_count = header.node_count + 100; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ reinterpret_cast<detail::image_header*>(data)->names_offset = header.nodes_offset + 4; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ reinterpret_cast<detail::image_header*>(data)->operation_count = 5; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 0)->left = 0; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 1)->right = 0; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 0)->right = header.node_count; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 0)->operation = header.operation_count; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 2)->left = header.value_count; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 3)->left = header.variable_count; })(), const serialization_error&);
+	REQUIRE_THROWS_AS(damaged([&](char *data){ node(data, 0)->right = 2; })(), const serialization_error&);
+
+	// Pointers that are not listed can not be imaged.
+	REQUIRE_THROWS_AS(write_image(ss, tree, registry), const serialization_error&);
+
+	// Deep trees are written and evaluated without recursion.
+	std::decay_t<decltype(tree)> deep;
+	auto *n = &deep.root();
+	for(int i = 0; i != 5000; ++i)
+	{
+		*n = add;
+		n->left() = 1;
+		n = &n->right();
+	}
+	*n = &x;
+
+	stringstream deep_ss;
+	write_image(deep_ss, deep, registry, {&x});
+
+	string deep_bytes = deep_ss.str();
+	vector<std::uint64_t> deep_aligned(deep_bytes.size() / sizeof(std::uint64_t) + 1);
+	memcpy(deep_aligned.data(), deep_bytes.data(), deep_bytes.size());
+
+	REQUIRE(image_view<int>(deep_aligned.data(), deep_bytes.size(), registry).evaluate(variables) == 5001);
+};
+
+TEST_CASE("image", "Write a tree image and evaluate it in place.")
+{
+	all_policies<int>(image);
+}
+
+auto parse_int = [](auto&& tree)
+{
+	operation_registry<int> registry;
+	registry.add("add", plus<int>());
+	registry.add("subtract", minus<int>());
+	registry.add("multiply", multiplies<int>());
+	registry.add("max", [](const int& a, const int& b){ return a > b ? a : b; });
+	registry.add("power", [](const int& a, const int& b){ int p = 1; for(int i = 0; i != b; ++i) p *= a; return p; });
+
+	int a = 4, b = 10;
+
+	grammar<int> g(registry);
+	g.binary("+", "add", 1).binary("-", "subtract", 1).binary("*", "multiply", 2).binary("**", "power", 3, true);
+	g.variable("a", &a).variable("b", &b);
+
+	parse("2*a + (b - 3)", tree.root(), g);
+	REQUIRE(tree.evaluate() == 15);
+
+	a = 1;
+	REQUIRE(tree.evaluate() == 9);
+
+	parse("1 + 2 * 3 - 4", tree.root(), g);
+	REQUIRE(tree.evaluate() == 3);
+
+	parse("2 ** 3 ** 2", tree.root(), g);
+	REQUIRE(tree.evaluate() == 512);
+
+	parse("max(a, b * -2) - 1", tree.root(), g);
+	REQUIRE(tree.evaluate() == 0);
+
+	// A parsed tree remains modifiable.
+	tree.left().right() = 7;
+	REQUIRE(tree.evaluate() == 6);
+
+	// A malformed expression leaves the tree unmodified.
+	REQUIRE_THROWS_AS(parse("1 + (2 * c)", tree.root(), g), const parse_error&);
+	REQUIRE_THROWS_AS(parse("1 + ", tree.root(), g), const parse_error&);
+	REQUIRE_THROWS_AS(parse("(1 + 2", tree.root(), g), const parse_error&);
+	REQUIRE(tree.evaluate() == 6);
+};
+
+TEST_CASE("parse_int", "Parse int expressions into a tree.")
+{
+	all_policies<int>(parse_int);
+}
+
+auto parse_string = [](auto&& tree)
+{
+	operation_registry<string> registry;
+	registry.add("concatenate", plus<string>());
+
+	string s = "apple";
+
+	grammar<string> g(registry);
+	g.binary("+", "concatenate", 1).variable("s", &s);
+
+	parse("s + \" \\\"pie\\\"\"", tree.root(), g);
+	REQUIRE(tree.evaluate() == "apple \"pie\"");
+};
+
+TEST_CASE("parse_string", "Parse string expressions into a tree.")
+{
+	all_policies<string>(parse_string);
+}
+
+TEST_CASE("copy_caching", "Copies of caching trees notify their own branches.")
+{
+	tree<int, cache_on_evaluation> t;
+	t.root() = plus<int>();
+	t.left() = plus<int>();
+	t.left().left() = 1;
+	t.left().right() = 2;
+	t.right() = 3;
+	REQUIRE(t.evaluate() == 6);
+
+	tree<int, cache_on_evaluation> c = t;
+	c.left().left() = 10;
+	REQUIRE(c.evaluate() == 15);
+	REQUIRE(t.evaluate() == 6);
+}
+
+auto stream = [](auto&& tree)
+{
+	int a = 0, b = 0, c = 0;
+
+	// (a * b) + c
+	tree.root() = plus<int>();
+	tree.left() = multiplies<int>();
+	tree.left().left() = &a;
+	tree.left().right() = &b;
+	tree.right() = &c;
+
+	stream_options options;
+	options.block_size = 2;
+	options.read_size = 7;
+	options.header = true;
+
+	stringstream csv("a,b,ignored,c\n1,2,0,3\n4, 5 ,0,6\r\n\n7,8,0,9\n10,11,0,12"), results;
+	REQUIRE(evaluate_csv(csv, results, tree, {&a, &b, nullptr, &c}, options) == 4);
+	REQUIRE(results.str() == "5\n26\n65\n122\n");
+
+	// Records must have exactly as many well-formed fields as there are columns.
+	for(string bad : {"1,2,0,3\n4,5\n", "1,2,0,3\n4,5,0,6,7\n", "1,2,0,3,\n", "1,2.5,0,3\n", "1,2 2,0,3\n", "1,,0,3\n"})
+	{
+		stringstream malformed(bad), ignored;
+		REQUIRE_THROWS_AS(evaluate_csv(malformed, ignored, tree, {&a, &b, nullptr, &c}), const runtime_error&);
+	}
+
+	vector<int> records = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+	stringstream binary(string(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(int))), binary_results;
+	REQUIRE(evaluate_binary(binary, binary_results, tree, {&c, &a, &b}, options) == 3);
+
+	vector<int> values(3);
+	binary_results.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(int));
+	REQUIRE(values == (vector<int>{7, 34, 79}));
+};
+
+TEST_CASE("stream", "Evaluate a tree over streams of records.")
+{
+	all_policies<int>(stream);
+}
+
+auto forest_of_trees = [](auto&& tree)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+
+	int x = 2, y = 3;
+
+	// (x * y) + 1
+	tree.root() = add;
+	tree.left() = multiply;
+	tree.left().left() = &x;
+	tree.left().right() = &y;
+	tree.right() = 1;
+
+	// (x * y) * (x * y)
+	std::decay_t<decltype(tree)> other;
+	other.root() = multiply;
+	other.left() = multiply;
+	other.left().left() = &x;
+	other.left().right() = &y;
+	other.right() = other.left();
+
+	// Unregistered operations are not shared.
+	std::decay_t<decltype(tree)> unshared;
+	unshared.root() = minus<int>();
+	unshared.left() = 1;
+	unshared.right() = &x;
+
+	forest<int> f(registry);
+	REQUIRE(f.add(tree) == 0);
+	REQUIRE(f.add(other) == 1);
+	REQUIRE(f.add(unshared) == 2);
+	REQUIRE(f.size() == 3);
+
+	// x, y, x * y, 1, (x * y) + 1, (x * y) * (x * y), 1 - x
+	REQUIRE(f.graph().size() == 7);
+	REQUIRE(f.evaluate() == (vector<int>{7, 36, -1}));
+
+	x = 3;
+	REQUIRE(f.evaluate() == (vector<int>{10, 81, -2}));
+
+	// Shared vertices are evaluated once, whatever the number of threads.
+	vector<int> results;
+	for(size_t threads : {1, 2, 8})
+	{
+		f.evaluate(results, threads);
+		REQUIRE(results == (vector<int>{10, 81, -2}));
+	}
+
+	// Operations of another registry are not mistaken for the forest's own, even when their identifiers match.
+	operation_registry<int> others;
+	auto& subtract = others.add("subtract", minus<int>());
+	REQUIRE(subtract.id == add.id);
+
+	std::decay_t<decltype(tree)> foreign;
+	foreign.root() = subtract;
+	foreign.left() = 10;
+	foreign.right() = &x;
+
+	forest<int> g(registry);
+	g.add(foreign);
+	REQUIRE(g.evaluate() == vector<int>{7});
+
+	// Branches of impure operations are not shared, so each is evaluated.
+	int calls = 0;
+	auto& count = registry.add("count", [&calls](const int& l, const int& r){ ++calls; return l + r; });
+	REQUIRE(!count.traits.pure);
+
+	std::decay_t<decltype(tree)> counted, recounted;
+	counted.root() = count;
+	counted.left() = &x;
+	counted.right() = 1;
+	recounted.root() = count;
+	recounted.left() = &x;
+	recounted.right() = 1;
+
+	forest<int> h(registry);
+	h.add(counted);
+	h.add(recounted);
+
+	// x, 1, and each count
+	REQUIRE(h.graph().size() == 4);
+	REQUIRE(h.evaluate() == (vector<int>{4, 4}));
+	REQUIRE(calls == 2);
+
+	// Deep trees are merged without recursion: 1 + (1 + (1 + ...)).
+	std::decay_t<decltype(tree)> deep;
+	auto *n = &deep.root();
+	for(int i = 0; i != 5000; ++i)
+	{
+		*n = add;
+		n->left() = 1;
+		n = &n->right();
+	}
+	*n = &x;
+
+	forest<int> d(registry);
+	d.add(deep);
+	REQUIRE(d.graph().size() == 5002);
+	REQUIRE(d.evaluate() == vector<int>{5003});
+};
+
+TEST_CASE("forest", "Evaluate many trees at once.")
+{
+	all_policies<int>(forest_of_trees);
+}
+
+auto forest_of_bools = [](auto&& tree)
+{
+	operation_registry<bool> registry;
+	auto& both = registry.add("and", logical_and<bool>());
+	auto& either = registry.add("or", logical_or<bool>());
+
+	bool x = true, y = false;
+
+	// (x && y) || y
+	tree.root() = either;
+	tree.left() = both;
+	tree.left().left() = &x;
+	tree.left().right() = &y;
+	tree.right() = &y;
+
+	// x && true
+	std::decay_t<decltype(tree)> other;
+	other.root() = both;
+	other.left() = &x;
+	other.right() = true;
+
+	forest<bool> f(registry);
+	f.add(tree);
+	f.add(other);
+	REQUIRE(f.evaluate() == (vector<bool>{false, true}));
+
+	y = true;
+	vector<bool> results;
+	for(size_t threads : {1, 4})
+	{
+		f.evaluate(results, threads);
+		REQUIRE(results == (vector<bool>{true, true}));
+	}
+};
+
+TEST_CASE("forest_bool", "Evaluate many boolean trees at once.")
+{
+	all_policies<bool>(forest_of_bools);
+}
+
+template<class E>
+void profile_tree()
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+
+	int x = 3;
+
+	// (1 * 2) + x
+	tree<int, cache_on_evaluation, profiled<E>> t;
+	t.root() = add;
+	t.left() = multiply;
+	t.left().left() = 1;
+	t.left().right() = 2;
+	t.right() = &x;
+
+	// Nothing is measured unless a profile is started.
+	profile p;
+	REQUIRE(t.evaluate() == 5);
+	REQUIRE(!p.find(t.root()));
+
+	t.left().right() = 4;
+
+	p.start();
+	REQUIRE(t.evaluate() == 7);
+	REQUIRE(t.evaluate() == 7);
+	p.stop();
+	REQUIRE(t.evaluate() == 7);
+
+	REQUIRE(p.find(t.root())->evaluations == 2);
+	REQUIRE(p.find(t.root())->hits == 0);
+	REQUIRE(p.find(t.left())->evaluations == 1);
+	REQUIRE(p.find(t.left())->hits == 1);
+	REQUIRE(!p.find(t.right()));
+
+	stringstream report;
+	p.report(report, t, &registry);
+	REQUIRE(report.str().find("root\tadd\t2\t0\t") != string::npos);
+	REQUIRE(report.str().find("root.l\tmultiply\t1\t1\t") != string::npos);
+
+	stringstream collapsed;
+	p.collapsed(collapsed, t, &registry);
+	REQUIRE(collapsed.str().find("add;multiply[l] ") != string::npos);
+
+	// Deep trees are walked without recursion: 1 + (1 + (1 + ...)).
+	tree<int, cache_on_evaluation, profiled<E>> deep;
+	auto *n = &deep.root();
+	for(int i = 0; i != 2000; ++i)
+	{
+		*n = add;
+		n->left() = 1;
+		n = &n->right();
+	}
+	*n = 0;
+
+	p.start();
+	REQUIRE(deep.evaluate() == 2000);
+	p.stop();
+
+	stringstream deep_report;
+	p.report(deep_report, deep, &registry);
+
+	string deepest = "root";
+	for(int i = 0; i != 1999; ++i)
+	{
+		deepest += ".r";
+	}
+	REQUIRE(std::count(std::istreambuf_iterator<char>(deep_report), std::istreambuf_iterator<char>(), '\n') == 2001);
+	REQUIRE(deep_report.str().find('\n' + deepest + "\tadd\t1\t0\t") != string::npos);
+}
+
+TEST_CASE("profile", "Profile the evaluation of a tree's branches.")
+{
+	profile_tree<sequential>();
+	profile_tree<parallel>();
+}
+
+template<template<typename, typename> class C, class E>
+cache_counters count_cache()
+{
+	int x = 3;
+
+	// (1 * 2) + x
+	tree<int, C, E> t;
+	t.root() = plus<int>();
+	t.left() = multiplies<int>();
+	t.left().left() = 1;
+	t.left().right() = 2;
+	t.right() = &x;
+
+	REQUIRE(t.evaluate() == 5);
+	REQUIRE(t.evaluate() == 5);
+
+	t.left().right() = 4;
+	REQUIRE(t.evaluate() == 7);
+
+	// Copies start counting anew.
+	REQUIRE(decltype(t)(t).cache_statistics().misses == 0);
+
+	return t.cache_statistics();
+}
+
+template<class E>
+void count_cache_all()
+{
+	auto c = count_cache<cache_on_evaluation, counted<E>>();
+	REQUIRE(c.hits == 1);
+	REQUIRE(c.misses == 5);
+	REQUIRE(c.invalidations == 1);
+	REQUIRE(c.eager_evaluations == 0);
+
+	c = count_cache<cache_on_assignment, counted<E>>();
+	REQUIRE(c.hits == 3);
+	REQUIRE(c.misses == 3);
+	REQUIRE(c.invalidations == 1);
+	REQUIRE(c.eager_evaluations == 2);
+
+	// Nothing is counted by non-caching branches or without the counted policy.
+	REQUIRE((count_cache<no_caching, counted<E>>().misses == 0));
+	REQUIRE((count_cache<cache_on_evaluation, E>().misses == 0));
+}
+
+TEST_CASE("cache_counters", "Count cache hits, misses, invalidations and eager evaluations.")
+{
+	count_cache_all<sequential>();
+	count_cache_all<parallel>();
+}
+
+template<typename T, template<typename, typename> class C, class E>
+void measure_tree()
+{
+	T x = T(), y = T();
+
+	// (x + y) + constant
+	allocation_counter counter;
+	counter.start();
+
+	auto t = make_unique<tree<T, C, E>>();
+	t->root() = plus<T>();
+	t->left() = plus<T>();
+	t->left().left() = &x;
+	t->left().right() = [&y]{ return y; };
+	t->right() = T();
+
+	auto m = t->memory_usage();
+	REQUIRE(m.constants == sizeof(detail::leaf<T>));
+	REQUIRE(m.pointers == sizeof(detail::leaf<T*>));
+	REQUIRE(m.callables == sizeof(detail::leaf<T (*)()>));
+	REQUIRE((m.branches + m.operations) == 2 * sizeof(typename C<T, E>::branch));
+	REQUIRE(m.operations == 2 * sizeof(detail::operation<T>));
+	REQUIRE(m.total() >= (m.branches + m.operations));
+
+	// Five node implementations, none of which was released yet.
+	REQUIRE(counter.allocations.load() == 5);
+	REQUIRE(counter.deallocations.load() == 0);
+	REQUIRE(counter.allocated.load() == (m.constants + m.pointers + m.callables + m.branches + m.operations));
+
+	t.reset();
+	counter.stop();
+
+	REQUIRE(counter.deallocations.load() == 5);
+	REQUIRE(counter.deallocated.load() == counter.allocated.load());
+}
+
+TEST_CASE("memory_usage", "Account for the memory used by a tree.")
+{
+	measure_tree<int, no_caching, sequential>();
+	measure_tree<int, cache_on_evaluation, sequential>();
+	measure_tree<int, cache_on_assignment, parallel>();
+	measure_tree<string, cache_on_evaluation, sequential>();
+
+	// Long strings own heap memory.
+	tree<string> t;
+	t.root() = string(1000, 'a');
+	REQUIRE(t.memory_usage().values > 1000);
+}
+
+auto pool_of_nodes = [](auto&& t)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+
+	int x = 3;
+
+	// (1 * 2) + x
+	pool_tree<int> built;
+	auto one = built.constant(1), two = built.constant(2);
+	auto product = built.branch(multiply, one, two);
+	auto sum = built.branch(add, product, built.pointer(&x));
+
+	REQUIRE(built.root() == sum);
+	REQUIRE(built.size() == 5);
+	REQUIRE(built.links(product).parent == sum);
+	REQUIRE(built.links(sum).parent == pool_tree<int>::none);
+	REQUIRE(built.kind_of(product) == pool_tree<int>::kind::branch);
+	REQUIRE(built.evaluate() == 5);
+	REQUIRE(built.evaluate(product) == 2);
+
+	built.assign(two, 4);
+	x = 1;
+	REQUIRE(built.evaluate() == 5);
+
+	// A node can only have one parent.
+	REQUIRE_THROWS_AS(built.branch(add, one, one), const invalid_argument&);
+	REQUIRE_THROWS_AS(built.branch(add, sum, pool_tree<int>::none), const invalid_argument&);
+
+	// A failed branch leaves the pool as it was, even if only one child is taken.
+	auto three = built.constant(3);
+	REQUIRE_THROWS_AS(built.branch(add, three, one), const invalid_argument&);
+	REQUIRE_THROWS_AS(built.branch(plus<int>(), three, one), const invalid_argument&);
+	REQUIRE(built.size() == 6);
+	REQUIRE(built.root() == three);
+	REQUIRE(built.evaluate() == 3);
+	REQUIRE(built.links(three).parent == pool_tree<int>::none);
+	REQUIRE(built.links(one).parent == product);
+
+	auto five = built.constant(5);
+	REQUIRE(built.evaluate(built.branch(add, three, five)) == 8);
+
+	// (x - 1) * 2, copied from a node.
+	t.root() = multiply;
+	t.left() = minus<int>();
+	t.left().left() = &x;
+	t.left().right() = 1;
+	t.right() = 2;
+
+	pool_tree<int> copied(registry);
+	copied.add(t);
+
+	x = 5;
+	REQUIRE(copied.evaluate() == t.evaluate());
+	REQUIRE(copied.kind_of(0) == pool_tree<int>::kind::pointer);
+	REQUIRE(copied.links(copied.root()).left == 2);
+
+	// Links are four 32-bit indices.
+	REQUIRE(sizeof(pool_tree<int>::slot) == 16);
+	REQUIRE(copied.memory_usage().total() < t.memory_usage().total());
+
+	// Like a sequential tree, a branch evaluates its right child first.
+	string order;
+	pool_tree<int> ordered;
+	auto left = ordered.callable([&order]{ order += 'l'; return 1; });
+	auto right = ordered.callable([&order]{ order += 'r'; return 2; });
+	REQUIRE(ordered.evaluate(ordered.branch(add, left, right)) == 3);
+	REQUIRE(order == "rl");
+
+	// Deep trees are copied and evaluated without recursion.
+	std::decay_t<decltype(t)> deep;
+	auto *n = &deep.root();
+	for(int i = 0; i != 5000; ++i)
+	{
+		*n = add;
+		n->left() = 1;
+		n = &n->right();
+	}
+	*n = &x;
+
+	pool_tree<int> flattened(registry);
+	flattened.add(deep);
+	REQUIRE(flattened.size() == 10001);
+	REQUIRE(flattened.evaluate() == 5005);
+};
+
+TEST_CASE("pool", "Store trees in contiguous arrays.")
+{
+	all_policies<int>(pool_of_nodes);
+}
+
+auto frozen = [](auto&& t)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+
+	int x = 3;
+
+	// ((1 - x) + 2) + (x * x)
+	t.root() = add;
+	t.left() = add;
+	t.left().left() = minus<int>();
+	t.left().left().left() = 1;
+	t.left().left().right() = &x;
+	t.left().right() = 2;
+	t.right() = multiplies<int>();
+	t.right().left() = &x;
+	t.right().right() = [&x]{ return x; };
+
+	frozen_tree<int> f(t, registry);
+	REQUIRE(f.size() == 9);
+	REQUIRE(f.depth() == 4);
+	REQUIRE((f.level(0) == make_pair<size_t, size_t>(0, 1)));
+	REQUIRE((f.level(1) == make_pair<size_t, size_t>(1, 3)));
+	REQUIRE((f.level(2) == make_pair<size_t, size_t>(3, 7)));
+	REQUIRE((f.level(3) == make_pair<size_t, size_t>(7, 9)));
+	REQUIRE(f.left(0) == 1);
+	REQUIRE(f.left(2) == 5);
+	REQUIRE(f.kind_of(3) == frozen_tree<int>::kind::branch);
+	REQUIRE(f.kind_of(6) == frozen_tree<int>::kind::callable);
+	REQUIRE(f.evaluate() == t.evaluate());
+
+	node_values<int> values;
+	x = -2;
+	REQUIRE(f.evaluate(values) == t.evaluate());
+	REQUIRE(values.size() == 9);
+	REQUIRE(values[2] == 4);
+
+	std::decay_t<decltype(t)> unformed;
+	unformed.root() = add;
+	REQUIRE_THROWS_AS(frozen_tree<int>(unformed, registry), const invalid_argument&);
+
+	// Operations of another registry are copied rather than mistaken for the one with the same identifier.
+	operation_registry<int> others;
+	auto& subtract = others.add("subtract", minus<int>());
+	REQUIRE(subtract.id == add.id);
+
+	std::decay_t<decltype(t)> foreign;
+	foreign.root() = subtract;
+	foreign.left() = 10;
+	foreign.right() = &x;
+	REQUIRE(frozen_tree<int>(foreign, registry).evaluate() == 12);
+};
+
+TEST_CASE("frozen", "Evaluate a tree laid out level by level.")
+{
+	all_policies<int>(frozen);
+}
+
+auto frozen_bools = [](auto&& t)
+{
+	operation_registry<bool> registry;
+	auto& both = registry.add("and", logical_and<bool>());
+	auto& either = registry.add("or", logical_or<bool>());
+
+	bool x = true, y = false;
+
+	// (x && y) || (x && true)
+	t.root() = either;
+	t.left() = both;
+	t.left().left() = &x;
+	t.left().right() = &y;
+	t.right() = both;
+	t.right().left() = &x;
+	t.right().right() = true;
+
+	frozen_tree<bool> f(t, registry);
+	REQUIRE(f.evaluate() == true);
+
+	level_options options;
+	options.threads = 2;
+	options.chunk = 1;
+
+	node_values<bool> values;
+	x = false;
+	REQUIRE(f.evaluate(values, options) == false);
+	REQUIRE(values.size() == 7);
+
+	y = x = true;
+	REQUIRE(f.evaluate(values, options) == true);
+	REQUIRE(values[1] == true);
+};
+
+TEST_CASE("frozen_bool", "Evaluate a boolean tree laid out level by level.")
+{
+	all_policies<bool>(frozen_bools);
+}
+
+// Builds a balanced tree of sums with 2^height leaves, every eighth of which is x.
+template<typename N>
+void balanced(N& n, size_t height, size_t& leaf, const int& x)
+{
+	if(height == 0)
+	{
+		if(leaf++ % 8 == 0) n = &x;
+		else n = static_cast<int>(leaf % 10);
+
+		return;
+	}
+
+	n = plus<int>();
+	balanced(n.left(), height - 1, leaf, x);
+	balanced(n.right(), height - 1, leaf, x);
+}
+
+TEST_CASE("level_parallel", "Evaluate a wide tree level by level on many threads.")
+{
+	int x = 1;
+	size_t leaf = 0;
+
+	tree<int> t;
+	balanced(t.root(), 12, leaf, x);
+
+	frozen_tree<int> f(t);
+
+	level_options options;
+	options.threads = 4;
+	options.chunk = 64;
+
+	node_values<int> values;
+	REQUIRE(f.evaluate(values, options) == t.evaluate());
+
+	x = 7;
+	REQUIRE(f.evaluate(values, options) == t.evaluate());
+	REQUIRE(values.size() == f.size());
+
+	// Threads are kept across evaluations, and an evaluation nested in an operation runs on its own thread rather than waiting for them.
+	tree<int> outer;
+	outer.root() = [&](const int& l, const int& r){ node_values<int> inner; return f.evaluate(inner, options) + l + r; };
+	outer.left() = t;
+	outer.right() = 1;
+
+	frozen_tree<int> g(outer);
+	for(int i = 0; i != 20; ++i)
+	{
+		x = i;
+		REQUIRE(g.evaluate(values, options) == 2 * t.evaluate() + 1);
+	}
+
+	// Operations that throw stop the evaluation.
+	tree<int> throwing;
+	throwing.root() = [](const int&, const int&) -> int { throw runtime_error("operation"); };
+	throwing.left() = 1;
+	throwing.right() = 2;
+
+	options.chunk = 1;
+	REQUIRE_THROWS_AS(frozen_tree<int>(throwing).evaluate(values, options), const runtime_error&);
+}
+
+TEST_CASE("forest_scheduler", "Evaluate a large forest on many threads.")
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+
+	int x = 1;
+	size_t leaf = 0;
+
+	tree<int> t;
+	balanced(t.root(), 10, leaf, x);
+
+	// t's operations are not registered, so the graph holds four copies of it side by side, but their leaves are shared.
+	forest<int> f(registry);
+	for(int i = 0; i != 4; ++i)
+	{
+		tree<int> u;
+		u.root() = add;
+		u.left() = t;
+		u.right() = i;
+		f.add(u);
+	}
+
+	vector<int> results;
+	f.evaluate(results, 4);
+	REQUIRE(results == f.evaluate());
+	REQUIRE(results[3] == t.evaluate() + 3);
+
+	// Threads are kept across evaluations.
+	for(x = 0; x != 20; ++x)
+	{
+		f.evaluate(results, 4);
+		REQUIRE(results[0] == t.evaluate());
+	}
+
+	// Concurrent and nested evaluations each get threads of their own.
+	{
+		detail::workers outer(3), other(3);
+		REQUIRE(outer.size() == 3);
+		REQUIRE(other.size() == 3);
+
+		atomic<size_t> nested(0);
+		outer.run([&]{ detail::workers inner(2); nested += inner.size(); inner.run([]{}); });
+		REQUIRE(nested.load() == 6);
+	}
+
+	vector<int> concurrent_results;
+	thread concurrent([&]{ f.evaluate(concurrent_results, 4); });
+	f.evaluate(results, 4);
+	concurrent.join();
+	REQUIRE(concurrent_results == results);
+
+	// Operations that throw stop the evaluation.
+	tree<int> throwing;
+	throwing.root() = [](const int&, const int&) -> int { throw runtime_error("operation"); };
+	throwing.left() = 1;
+	throwing.right() = 2;
+	f.add(throwing);
+
+	REQUIRE_THROWS_AS(f.evaluate(results, 4), const runtime_error&);
+}
+
+auto interruptible = [](auto&& t)
+{
+	using namespace std::chrono;
+
+	stop_source source;
+	size_t calls = 0;
+	bool stop = false;
+
+	// A left-deep tree of 64 sums whose deepest leaf requests a stop.
+	auto *n = &t.root();
+	for(int i = 0; i != 64; ++i)
+	{
+		*n = plus<int>();
+		n->right() = 1;
+		n = &n->left();
+	}
+	*n = function<int ()>([&]{ ++calls; if(stop) source.request_stop(); return 0; });
+
+	int value = -1;
+	REQUIRE(t.evaluate(value, stop_source().token()) == evaluation_status::completed);
+	REQUIRE(value == 64);
+
+	stop = true;
+	REQUIRE(t.evaluate(value, source.token()) == evaluation_status::cancelled);
+	REQUIRE(calls == 2);
+
+	// A stop that was requested already prevents the evaluation altogether.
+	REQUIRE(t.evaluate(value, source.token()) == evaluation_status::cancelled);
+	REQUIRE(calls == 2);
+
+	// A slow leaf makes the evaluation overrun its deadline.
+	*n = function<int ()>([]{ this_thread::sleep_for(milliseconds(20)); return 0; });
+	REQUIRE(t.evaluate(value, stop_token(), steady_clock::now() + milliseconds(5)) == evaluation_status::timed_out);
+	REQUIRE(t.evaluate(value, stop_token(), steady_clock::now() - milliseconds(1)) == evaluation_status::timed_out);
+
+	value = -1;
+	REQUIRE(t.evaluate(value, stop_token(), steady_clock::now() + seconds(10)) == evaluation_status::completed);
+	REQUIRE(value == 64);
+	REQUIRE(t.evaluate() == 64);
+
+	// The deadline is checked from the first branch on, however few branches there are.
+	std::decay_t<decltype(t)> small;
+	small.root() = plus<int>();
+	small.left() = function<int ()>([]{ this_thread::sleep_for(milliseconds(20)); return 0; });
+	small.right() = 1;
+	REQUIRE(small.evaluate(value, stop_token(), steady_clock::now() + milliseconds(5)) == evaluation_status::timed_out);
+};
+
+TEST_CASE("interruptible", "Cancel evaluations and bound them by a deadline.")
+{
+	all_policies<int>(interruptible);
+}
+
+auto nary_branches = [](auto&& t)
+{
+	int x = 2;
+
+	// sum(x, 1, ..., 999)
+	t.root() = sum<int>(1000);
+	REQUIRE(t.arity() == 1000);
+
+	t.child(0) = &x;
+	for(int i = 1; i != 1000; ++i)
+	{
+		t.child(i) = i;
+	}
+
+	REQUIRE(t.evaluate() == 2 + 999 * 1000 / 2);
+
+	x = 3;
+	REQUIRE(t.evaluate() == 3 + 999 * 1000 / 2);
+
+	// max(product(x, 4, x), minimum(7, 5), x)
+	t.root() = maximum<int>(3);
+	t.child(0) = product<int>(3);
+	t.child(0).child(0) = &x;
+	t.child(0).child(1) = 4;
+	t.child(0).child(2) = &x;
+	t.child(1) = minimum<int>(2);
+	t.child(1).left() = 7;
+	t.child(1).right() = 5;
+	t.child(2) = &x;
+
+	REQUIRE(t.child(1).arity() == 2);
+	REQUIRE(t.child(1).constant());
+	REQUIRE(!t.constant());
+	REQUIRE(t.evaluate() == 36);
+
+	x = 1;
+	REQUIRE(t.evaluate() == 5);
+
+	// Binary and n-ary branches mix.
+	auto copy = t;
+	copy.child(2) = plus<int>();
+	copy.child(2).left() = 10;
+	copy.child(2).right() = &x;
+	REQUIRE(copy.evaluate() == 11);
+	REQUIRE(t.evaluate() == 5);
+
+	REQUIRE_THROWS_AS(t.root() = sum<int>(0), const invalid_argument&);
+};
+
+TEST_CASE("nary", "Build trees with n-ary branches.")
+{
+	all_policies<int>(nary_branches);
+
+	tree<string> t;
+	t.root() = nary<string>([](const string *v, size_t n){ string s; for(size_t i = 0; i != n; ++i) s += v[i]; return s; }, 3);
+	t.child(0) = string("a");
+	t.child(1) = string("b");
+	t.child(2) = string("c");
+	REQUIRE(t.evaluate() == "abc");
+
+	// Values gathered before a child throws are destroyed.
+	t.child(1) = []() -> string { throw runtime_error("leaf"); };
+	REQUIRE_THROWS_AS(t.evaluate(), const runtime_error&);
+}
+
+auto nary_bools = [](auto&& t)
+{
+	auto all = nary<bool>([](const bool *values, size_t n){ return all_of(values, values + n, [](bool b){ return b; }); }, 3);
+	bool x = true;
+
+	// all(x, true, any(false, ..., x))
+	t.root() = all;
+	t.child(0) = &x;
+	t.child(1) = true;
+	t.child(2) = nary<bool>([](const bool *values, size_t n){ return any_of(values, values + n, [](bool b){ return b; }); }, 20);
+	for(size_t i = 0; i != 19; ++i)
+	{
+		t.child(2).child(i) = false;
+	}
+	t.child(2).child(19) = &x;
+
+	REQUIRE(t.evaluate() == true);
+
+	x = false;
+	REQUIRE(t.evaluate() == false);
+};
+
+TEST_CASE("nary_bool", "Reduce the values of boolean children.")
+{
+	all_policies<bool>(nary_bools);
+}
+
+auto unary_branches = [](auto&& t)
+{
+	int x = 3;
+
+	// -(|x - 5| * 2)
+	t.root() = negate<int>();
+	REQUIRE(t.arity() == 1);
+
+	t.left() = multiplies<int>();
+	t.left().left() = [](const int& i){ return abs(i); };
+	t.left().left().left() = minus<int>();
+	t.left().left().left().left() = &x;
+	t.left().left().left().right() = 5;
+	t.left().right() = 2;
+
+	REQUIRE(t.evaluate() == -4);
+
+	x = 10;
+	REQUIRE(t.evaluate() == -10);
+
+	// A unary branch over a constant is constant.
+	t.left().left().left() = 7;
+	REQUIRE(t.constant());
+	REQUIRE(t.evaluate() == -14);
+
+	auto m = t.memory_usage();
+	REQUIRE(m.constants == 2 * sizeof(detail::leaf<int>));
+};
+
+TEST_CASE("unary", "Build trees with unary branches.")
+{
+	all_policies<int>(unary_branches);
+
+	double d = 16.;
+
+	tree<double, cache_on_evaluation> t;
+	t.root() = [](const double& v){ return sqrt(v); };
+	t.left() = &d;
+	REQUIRE(t.evaluate() == 4.);
+
+	d = 9.;
+	REQUIRE(t.evaluate() == 3.);
+}
+
+auto lazy_branches = [](auto&& t)
+{
+	int x = 1;
+	size_t evaluations[3] = {0, 0, 0};
+
+	auto counted_leaf = [&](size_t i, int v){ return function<int ()>([&evaluations, &x, i, v]{ ++evaluations[i]; return v * x; }); };
+
+	// if(x, 10 * x, 20 * x)
+	t.root() = if_then_else<int>();
+	t.child(0) = &x;
+	t.child(1) = counted_leaf(1, 10);
+	t.child(2) = counted_leaf(2, 20);
+
+	REQUIRE(t.evaluate() == 10);
+	REQUIRE(evaluations[1] == 1);
+	REQUIRE(evaluations[2] == 0);
+
+	x = 0;
+	REQUIRE(t.evaluate() == 0);
+	REQUIRE(evaluations[1] == 1);
+	REQUIRE(evaluations[2] == 1);
+
+	// and(x, 1 * x, 2 * x) stops at the first child that is zero.
+	t.root() = short_circuit_and<int>(3);
+	t.child(0) = counted_leaf(0, 1);
+	t.child(1) = &x;
+	t.child(2) = counted_leaf(2, 2);
+
+	x = 0;
+	REQUIRE(t.evaluate() == 0);
+	REQUIRE(evaluations[0] == 1);
+	REQUIRE(evaluations[2] == 1);
+
+	x = 3;
+	REQUIRE(t.evaluate() == 6);
+	REQUIRE(evaluations[2] == 2);
+
+	// or(0, x) is x.
+	t.root() = short_circuit_or<int>();
+	t.left() = 0;
+	t.right() = &x;
+	REQUIRE(t.evaluate() == 3);
+
+	x = 0;
+	REQUIRE(t.evaluate() == 0);
+
+	// Constant lazy branches are cached like any other.
+	t.right() = 4;
+	REQUIRE(t.constant());
+	REQUIRE(t.evaluate() == 4);
+
+	REQUIRE_THROWS_AS(t.root() = short_circuit_and<int>(0), const invalid_argument&);
+
+	// Children of other types than bool are not reordered, so the first one that settles the result keeps deciding its value.
+	REQUIRE(short_circuit_or<int>(2, 8).reorder_period == 0);
+	REQUIRE(short_circuit_and<int>(2, 8).reorder_period == 0);
+	REQUIRE(short_circuit_or<bool>(2, 8).reorder_period == 8);
+};
+
+TEST_CASE("lazy", "Build trees with short-circuiting branches.")
+{
+	all_policies<int>(lazy_branches);
+
+	bool a = true, b = false;
+	size_t calls = 0;
+
+	tree<bool> t;
+	t.root() = short_circuit_or<bool>();
+	t.left() = &a;
+	t.right() = function<bool ()>([&]{ ++calls; return b; });
+
+	REQUIRE(t.evaluate());
+	REQUIRE(calls == 0);
+
+	a = false;
+	REQUIRE(!t.evaluate());
+	REQUIRE(calls == 1);
+}
+
+auto reordered_branches = [](auto&& t)
+{
+	size_t expensive = 0, cheap = 0;
+	bool rare = true, frequent = false;
+
+	// and(expensive, cheap), where only the cheap child is ever false.
+	t.root() = short_circuit_and<bool>(2, 8);
+	t.child(0) = function<bool ()>([&]{ ++expensive; return rare; });
+	t.child(1) = function<bool ()>([&]{ ++cheap; return frequent; });
+
+	REQUIRE((t.evaluation_order() == vector<size_t>{0, 1}));
+
+	for(int i = 0; i != 8; ++i)
+	{
+		REQUIRE(!t.evaluate());
+	}
+
+	REQUIRE(expensive == 8);
+	REQUIRE(cheap == 8);
+	REQUIRE((t.evaluation_order() == vector<size_t>{1, 0}));
+
+	// The cheap child now settles the result on its own.
+	for(int i = 0; i != 8; ++i)
+	{
+		REQUIRE(!t.evaluate());
+	}
+
+	REQUIRE(expensive == 8);
+	REQUIRE(cheap == 16);
+
+	// Operations that do not reorder keep their children's order.
+	t.root() = short_circuit_or<bool>();
+	t.left() = true;
+	t.right() = false;
+	REQUIRE(t.evaluate());
+	REQUIRE((t.evaluation_order() == vector<size_t>{0, 1}));
+
+	// Reordering lowers the cost of evaluations without changing their results.
+	// The slow child is false one time in eight, the fast one three times in four.
+	int i = 0;
+	size_t costs[2] = {0, 0};
+
+	auto slow = [&](size_t& cost)
+	{
+		return function<bool ()>([&]
+		{
+			cost += 10;
+			auto until = chrono::steady_clock::now() + chrono::microseconds(20);
+			while(chrono::steady_clock::now() < until);
+
+			return i % 8 != 0;
+		});
+	};
+	auto fast = [&](size_t& cost){ return function<bool ()>([&]{ ++cost; return i % 4 == 0; }); };
+
+	std::decay_t<decltype(t)> fixed;
+	fixed.root() = short_circuit_and<bool>(2);
+	fixed.child(0) = slow(costs[0]);
+	fixed.child(1) = fast(costs[0]);
+
+	t.root() = short_circuit_and<bool>(2, 8);
+	t.child(0) = slow(costs[1]);
+	t.child(1) = fast(costs[1]);
+
+	for(i = 0; i != 64; ++i)
+	{
+		REQUIRE(t.evaluate() == fixed.evaluate());
+	}
+
+	REQUIRE((t.evaluation_order() == vector<size_t>{1, 0}));
+	REQUIRE((costs[1] * 2 < costs[0]));
+};
+
+TEST_CASE("reorder", "Reorder the children of short-circuiting branches.")
+{
+	all_policies<bool>(reordered_branches);
+}
+
+TEST_CASE("traits", "Algebraic properties of registered operations.")
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& subtract = registry.add("subtract", minus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+	auto& divide = registry.add("divide", divides<int>());
+	auto& power = registry.add("power", [](const int& a, const int& b){ int p = 1; for(int i = 0; i != b; ++i) p *= a; return p; });
+
+	REQUIRE(add.traits.associative);
+	REQUIRE(add.traits.commutative);
+	REQUIRE(add.traits.pure);
+	REQUIRE(add.traits.identity_side == side::both);
+	REQUIRE(add.traits.identity == 0);
+	REQUIRE(add.traits.absorbing_side == side::none);
+
+	REQUIRE(!subtract.traits.commutative);
+	REQUIRE(subtract.traits.identity_side == side::right);
+	REQUIRE(includes(subtract.traits.identity_side, side::right));
+	REQUIRE(!includes(subtract.traits.identity_side, side::left));
+
+	REQUIRE(multiply.traits.identity == 1);
+	REQUIRE(multiply.traits.absorbing_side == side::both);
+	REQUIRE(multiply.traits.absorbing == 0);
+
+	REQUIRE(divide.traits.identity_side == side::right);
+	REQUIRE(divide.traits.cost > multiply.traits.cost);
+
+	// Nothing is assumed of other callables.
+	REQUIRE(!power.traits.pure);
+	REQUIRE(!power.traits.associative);
+	REQUIRE(power.traits.identity_side == side::none);
+
+	// Unless they are registered with their traits.
+	operation_traits<int> traits;
+	traits.associative = traits.commutative = traits.pure = true;
+	traits.identity_side = side::both;
+	traits.identity = numeric_limits<int>::min();
+
+	auto& maximum = registry.add("max", [](const int& a, const int& b){ return a > b ? a : b; }, traits);
+	REQUIRE(registry[maximum.id].traits.identity == numeric_limits<int>::min());
+
+	// Rounding makes floating point operations not associative.
+	operation_registry<double> doubles;
+	auto& real_add = doubles.add("add", plus<double>());
+	REQUIRE(!real_add.traits.associative);
+	REQUIRE(real_add.traits.commutative);
+
+	// Branches tell which registered operation they hold.
+	tree<int> t;
+	t.root() = multiply;
+	t.left() = plus<int>();
+	REQUIRE(t.root().operation() == multiply.id);
+	REQUIRE(t.left().operation() == unregistered_operation);
+	REQUIRE(t.right().operation() == unregistered_operation);
+}
+
+auto simplified_trees = [](auto&& t)
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& subtract = registry.add("subtract", minus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+
+	int a = 5, b = 7;
+
+	// (a * 1 + (0 + a)) - 0 is a * 2.
+	t.root() = subtract;
+	t.right() = 0;
+	t.left() = add;
+	t.left().left() = multiply;
+	t.left().left().left() = &a;
+	t.left().left().right() = 1;
+	t.left().right() = add;
+	t.left().right().left() = 0;
+	t.left().right().right() = &a;
+
+	REQUIRE(t.evaluate() == 10);
+	REQUIRE(simplify(t.root(), registry) == 4);
+	REQUIRE(t.root().operation() == multiply.id);
+	REQUIRE(t.left().arity() == 0);
+	REQUIRE(t.right().arity() == 0);
+	REQUIRE(t.evaluate() == 10);
+	a = 6;
+	REQUIRE(t.evaluate() == 12);
+
+	// Repeated additions accumulate: (a + a) + a is a * 3.
+	t.root() = add;
+	t.left() = add;
+	t.left().left() = &a;
+	t.left().right() = &a;
+	t.right() = &a;
+
+	REQUIRE(simplify(t.root(), registry) == 2);
+	REQUIRE(t.root().operation() == multiply.id);
+	REQUIRE(t.evaluate() == 18);
+
+	// Absorbing elements collapse branches, but only if what is discarded has no side effect.
+	t.root() = multiply;
+	t.left() = subtract;
+	t.left().left() = &a;
+	t.left().right() = &b;
+	t.right() = 0;
+
+	REQUIRE(simplify(t.root(), registry) == 1);
+	REQUIRE(t.root().arity() == 0);
+	REQUIRE(t.evaluate() == 0);
+
+	int calls = 0;
+	t.root() = multiply;
+	t.left() = function<int ()>([&calls]{ return ++calls; });
+	t.right() = 0;
+
+	REQUIRE(simplify(t.root(), registry) == 0);
+	REQUIRE(t.evaluate() == 0);
+	REQUIRE(calls == 1);
+
+	// Subtraction has no left identity and unregistered operations have no traits.
+	t.root() = subtract;
+	t.left() = 0;
+	t.right() = &a;
+	REQUIRE(simplify(t.root(), registry) == 0);
+
+	t.root() = multiplies<int>();
+	t.left() = &a;
+	t.right() = 1;
+	REQUIRE(simplify(t.root(), registry) == 0);
+
+	// Simplifying a subtree notifies its parent.
+	t.root() = add;
+	t.left() = &b;
+	t.right() = multiply;
+	t.right().left() = &a;
+	t.right().right() = 1;
+	REQUIRE(t.evaluate() == 13);
+
+	REQUIRE(simplify(t.right(), registry) == 1);
+	a = 1;
+	REQUIRE(t.evaluate() == 8);
+};
+
+TEST_CASE("simplify", "Simplify trees according to their operations' traits.")
+{
+	all_policies<int>(simplified_trees);
+}
+
+auto static_equivalents = [](auto&& t)
+{
+	int a = 2, b = 3;
+	int calls = 0;
+
+	// (a * (3 * 4)) - (b + c()), where c counts its calls.
+	auto e = make_variable(a) * (make_constant(3) * make_constant(4)) - (make_variable(b) + make_callable<int>([&calls]{ return ++calls; }));
+
+	e.assign_to(t.root());
+	REQUIRE(!t.root().constant());
+
+	// The static tree was converted to its equivalent and constant subtrees were folded.
+	REQUIRE(t.root().arity() == 2);
+	REQUIRE(t.left().right().arity() == 0);
+
+	REQUIRE(e.evaluate() == 20);
+	REQUIRE(t.evaluate() == 19);
+	REQUIRE(calls == 2);
+
+	a = 5;
+	calls = 0;
+	REQUIRE(e.evaluate() == 56);
+	calls = 0;
+	REQUIRE(t.evaluate() == 56);
+};
+
+TEST_CASE("static", "Trees whose shape is known at compile time.")
+{
+	// Constant trees are evaluated at compile time and keep only their value.
+	constexpr auto c = make_constant(2) * make_constant(3) + make_constant(4);
+	static_assert(c.evaluate() == 10, "constant static trees are evaluated at compile time");
+	static_assert(decltype(c)::is_constant, "constant static trees are constant");
+	REQUIRE(sizeof(c) == sizeof(int));
+	REQUIRE(c.constant());
+
+	// Pointer leaves are read at every evaluation.
+	int a = 1;
+	auto v = make_variable(a) + make_constant(1);
+	REQUIRE(!v.constant());
+	REQUIRE(v.evaluate() == 2);
+	a = 2;
+	REQUIRE(v.evaluate() == 3);
+
+	double x = 2.5;
+	auto d = make_branch([](const double& x, const double& y){ return x > y ? x : y; }, make_constant(1.5), make_variable(x));
+	REQUIRE(d.evaluate() == 2.5);
+
+	all_policies<int>(static_equivalents);
+}
+
+TEST_CASE("codegen", "Evaluate trees with generated native code.")
+{
+	operation_registry<int> registry;
+	auto& add = registry.add("add", plus<int>());
+	auto& multiply = registry.add("multiply", multiplies<int>());
+	auto& maximum = registry.add("max", [](const int& a, const int& b){ return a > b ? a : b; });
+
+	codegen_options options;
+	options.bodies["max"] = "a > b ? a : b";
+
+	int a = 3, calls = 0;
+
+	// max(a * (2 + 5), c()) + a, where c counts its calls.
+	tree<int> t;
+	t.root() = add;
+	t.right() = &a;
+	t.left() = maximum;
+	t.left().right() = function<int ()>([&calls]{ return ++calls; });
+	t.left().left() = multiply;
+	t.left().left().left() = &a;
+	t.left().left().right() = add;
+	t.left().left().right().left() = 2;
+	t.left().left().right().right() = 5;
+
+	REQUIRE(codegen(t, registry, options).find("a > b ? a : b") != string::npos);
+
+	compiled_tree<int> c(t, registry, options);
+	REQUIRE(c.diagnostic() == "");
+	REQUIRE(c.compiled());
+
+	REQUIRE(c.evaluate() == 24);
+	REQUIRE(calls == 1);
+
+	a = 10;
+	REQUIRE(c.evaluate() == 80);
+	REQUIRE(calls == 2);
+
+	// Modifying the tree falls back to its own evaluation until it is compiled again.
+	t.left().left().right().right() = 1;
+	REQUIRE(!c.compiled());
+	REQUIRE(c.evaluate() == 40);
+
+	REQUIRE(c.compile());
+	REQUIRE(c.compiled());
+	REQUIRE(c.evaluate() == 40);
+
+	t.root() = multiply;
+	t.left() = 4;
+	t.right() = 5;
+	REQUIRE(!c.compiled());
+	REQUIRE(c.evaluate() == 20);
+
+	// Operations without a body can not be generated.
+	t.root() = maximum;
+	t.left() = 4;
+	t.right() = 5;
+
+	compiled_tree<int> bodiless(t, registry);
+	REQUIRE(!bodiless.compiled());
+	REQUIRE(bodiless.diagnostic().find("max") != string::npos);
+	REQUIRE(bodiless.evaluate() == 5);
+	REQUIRE_THROWS_AS(codegen(t, registry), const codegen_error&);
+
+	// Nor can failing compilations.
+	options.bodies["max"] = "a >";
+	compiled_tree<int> broken(t, registry, options);
+	REQUIRE(!broken.compiled());
+	REQUIRE(broken.diagnostic() != "");
+	REQUIRE(broken.evaluate() == 5);
+
+	// Floating point constants are generated exactly.
+	operation_registry<double> reals;
+	tree<double> u;
+	u.root() = reals.add("add", plus<double>());
+	u.left() = 0.1;
+	u.right() = -1e300;
+
+	compiled_tree<double> d(u, reals);
+	REQUIRE(d.compiled());
+	REQUIRE(d.evaluate() == u.evaluate());
+
+	// Callables are called in the same order as the sequential policy calls them.
+	string order;
+	t.root() = add;
+	t.left() = function<int ()>([&order]{ order += 'l'; return 1; });
+	t.right() = function<int ()>([&order]{ order += 'r'; return 2; });
+
+	REQUIRE(t.evaluate() == 3);
+	REQUIRE(order == "rl");
+
+	// Paths are quoted for the shell.
+	string directory = "/tmp/expression tree's $(codegen)";
+	REQUIRE(mkdir(directory.c_str(), 0700) == 0);
+	options.directory = directory;
+
+	order.clear();
+	compiled_tree<int> e(t, registry, options);
+	REQUIRE(e.compiled());
+	REQUIRE(e.evaluate() == 3);
+	REQUIRE(order == "rl");
+
+	// Nothing is left behind.
+	REQUIRE(rmdir(directory.c_str()) == 0);
+}
+
+auto typed_branches = [](auto&& t)
+{
+	int a = 2;
+
+	// (a + 3) * 4
+	t.root() = typed<int>(multiplies<int>());
+	t.left() = typed<int>(plus<int>());
+	t.left().left() = &a;
+	t.left().right() = 3;
+	t.right() = 4;
+
+	REQUIRE(t.root().arity() == 2);
+	REQUIRE(t.root().operation() == unregistered_operation);
+	REQUIRE(t.evaluate() == 20);
+	a = 3;
+	REQUIRE(t.evaluate() == 24);
+
+	// Copies evaluate alike.
+	std::decay_t<decltype(t)> u;
+	u.root() = t;
+	a = 4;
+	REQUIRE(u.evaluate() == 28);
+
+	// Functors are stored by value, whatever their size.
+	array<int, 32> weights;
+	weights.fill(1);
+	auto weighted = [weights](const int& l, const int& r){ return l * weights[0] + r * weights[31]; };
+
+	t.root() = typed<int>(weighted);
+	t.left() = 5;
+	t.right() = 6;
+	REQUIRE(t.root().constant());
+	REQUIRE(t.evaluate() == 11);
+	REQUIRE(t.memory_usage().operations == sizeof(weighted));
+
+	// Typed branches mix with other kinds.
+	t.root() = plus<int>();
+	t.left() = typed<int>(minus<int>());
+	t.left().left() = 10;
+	t.left().right() = &a;
+	t.right() = 1;
+	REQUIRE(t.evaluate() == 7);
+};
+
+TEST_CASE("typed", "Branches that store their operation's functor by value.")
+{
+	all_policies<int>(typed_branches);
+}
+
+auto moved_nodes = [](auto&& t)
+{
+	using tree_t = std::decay_t<decltype(t)>;
+	using node_t = typename std::remove_reference_t<decltype(t.root())>;
+
+	static_assert(std::is_nothrow_move_constructible<node_t>::value, "nodes move without throwing");
+	static_assert(std::is_nothrow_move_constructible<tree_t>::value, "trees move without throwing");
+
+	int a = 1;
+
+	// (a + 2) * 3
+	t.root() = multiplies<int>();
+	t.left() = plus<int>();
+	t.left().left() = &a;
+	t.left().right() = 2;
+	t.right() = 3;
+
+	allocation_counter counter;
+	counter.start();
+
+	// Moving a tree transfers its nodes.
+	tree_t u(std::move(t));
+	REQUIRE(u.evaluate() == 9);
+
+	// Taking a subtree detaches it without cloning it, and moving it back in reattaches it.
+	auto sum = u.left().take();
+	REQUIRE(sum.evaluate() == 3);
+
+	u.left() = std::move(sum);
+	REQUIRE(u.evaluate() == 9);
+
+	// Replacing a branch with one of its children.
+	u.root() = u.left().take();
+	REQUIRE(u.evaluate() == 3);
+	a = 2;
+	REQUIRE(u.evaluate() == 4);
+
+	// Children's parents follow their node as it moves, so modifications still reach the root.
+	vector<node_t> nodes;
+	for(int i = 0; i != 8; ++i)
+	{
+		nodes.push_back(u.take());
+		u = std::move(nodes.back());
+		nodes.back() = 0;
+	}
+
+	u.left() = 5;
+	REQUIRE(u.evaluate() == 7);
+
+	tree_t v;
+	v = std::move(u);
+	v.right() = 10;
+	REQUIRE(v.evaluate() == 15);
+
+	counter.stop();
+
+	// Only leaves were allocated: one for each assignment of a value.
+	REQUIRE(counter.allocations.load() == 10);
+
+	// A node moved out of a tree has no parent, so the tree is not notified and the node can be swapped with the tree's root.
+	std::uint64_t generation = v.generation();
+	node_t n(std::move(v.left()));
+	REQUIRE(v.generation() == generation);
+	REQUIRE(n.evaluate() == 5);
+
+	n.swap(v.root());
+	REQUIRE(v.evaluate() == 5);
+	REQUIRE(v.generation() == generation + 1);
+};
+
+TEST_CASE("move", "Move nodes and trees without cloning them.")
+{
+	all_policies<int>(moved_nodes);
+}
+
+auto swapped_subtrees = [](auto&& t)
+{
+	using tree_t = std::decay_t<decltype(t)>;
+
+	int a = 1, b = 2;
+
+	// t: (a + 10) * 2
+	t.root() = multiplies<int>();
+	t.left() = plus<int>();
+	t.left().left() = &a;
+	t.left().right() = 10;
+	t.right() = 2;
+
+	// u: (b - 1) - 100
+	tree_t u;
+	u.root() = minus<int>();
+	u.left() = minus<int>();
+	u.left().left() = &b;
+	u.left().right() = 1;
+	u.right() = 100;
+
+	REQUIRE(t.evaluate() == 22);
+	REQUIRE(u.evaluate() == -99);
+
+	auto tg = t.generation(), ug = u.generation();
+
+	// t: (b - 1) * 2, u: (a + 10) - 100
+	t.left().swap(u.left());
+	REQUIRE(t.generation() == tg + 1);
+	REQUIRE(u.generation() == ug + 1);
+	REQUIRE(t.evaluate() == 2);
+	REQUIRE(u.evaluate() == -89);
+
+	// Swapped subtrees notify their new tree.
+	t.left().right() = 2;
+	u.left().right() = 20;
+	REQUIRE(t.evaluate() == 0);
+	REQUIRE(u.evaluate() == -79);
+
+	// t: 2 * (b - 2)
+	swap(t.left(), t.right());
+	REQUIRE(t.evaluate() == 0);
+	b = 7;
+	REQUIRE(t.evaluate() == 10);
+
+	REQUIRE_THROWS_AS(t.root().swap(t.right()), const invalid_argument&);
+	REQUIRE_THROWS_AS(t.right().left().swap(t.root()), const invalid_argument&);
+
+	// t: (a + 20) * 2, u: 100
+	tg = t.generation();
+	splice(t.right(), std::move(u.left()));
+	REQUIRE(t.generation() == tg + 1);
+	REQUIRE(t.evaluate() == 42);
+	u.root() = 100;
+	REQUIRE(u.evaluate() == 100);
+
+	// A node can receive one of its descendants, but not the other way around.
+	splice(t.root(), std::move(t.right().left()));
+	REQUIRE(t.evaluate() == 1);
+	REQUIRE_THROWS_AS(splice(u.root(), std::move(u.root())), const invalid_argument&);
+};
+
+TEST_CASE("swap", "Swap and splice subtrees without cloning them.")
+{
+	all_policies<int>(swapped_subtrees);
+}